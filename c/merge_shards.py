@@ -0,0 +1,145 @@
+"""
+Merges the output of a search split into shards (puzzle --shard=I/N) back together.
+
+Usage: python3 merge_shards.py SHARD_OUTPUT...
+
+Each shard's solutions are printed one after the other, numbered from 1 again, followed
+by how many were found altogether: solution counts, nodes visited and the pieces placed at
+each depth (with --count) are added up. The time taken is the slowest shard's, as if they
+ran side by side.
+
+With --batch, the shards' lines of CSV are added up instead, one line per puzzle.
+"""
+
+import re
+import sys
+
+
+BATCH_HEADER = "puzzle,spots,pieces,solutions,symmetric_solutions,nodes,seconds"
+
+SOLUTION = re.compile(r"^Solution \d+:$")
+SHARD = re.compile(r"^Shard (\d+)/(\d+):")
+FOUND = re.compile(r"^Found (\d+) solutions\.$")
+FOUND_DISTINCT = re.compile(r"^Found (\d+) distinct solutions \((\d+) counting their symmetric copies\)\.$")
+DEPTH = re.compile(r"^ ?(\d+): (\d+)$")
+VISITED = re.compile(r"^Visited (\d+) nodes in ([\d.]+) seconds")
+
+# Where the solutions stop: the summary after them.
+END_OF_SOLUTIONS = ("Shard ", "Searched using", "Found ", "Interupt detected", "Pieces placed at each depth")
+
+
+def merge_batch(lines):
+    """
+    Adds up the lines of CSV for each puzzle, keeping them in the order they first appear.
+    """
+    totals = {}
+    for line in lines:
+        if line == BATCH_HEADER:
+            continue
+        puzzle, spots, pieces, solutions, symmetric_solutions, nodes, seconds = line.rsplit(",", 6)
+        key = (puzzle, spots, pieces)
+        if key not in totals:
+            totals[key] = [0, 0, 0, 0.0]
+        total = totals[key]
+        total[0] += int(solutions)
+        total[1] += int(symmetric_solutions)
+        total[2] += int(nodes)
+        total[3] = max(total[3], float(seconds))
+
+    print(BATCH_HEADER)
+    for (puzzle, spots, pieces), (solutions, symmetric_solutions, nodes, seconds) in totals.items():
+        print("%s,%s,%s,%d,%d,%d,%.3f" % (puzzle, spots, pieces, solutions, symmetric_solutions, nodes, seconds))
+
+
+def merge_outputs(outputs):
+    printed_count = 0
+    solution_count = 0
+    symmetric_solution_count = None
+    placements_at_depth = []
+    nodes = 0
+    seconds = 0.0
+    shards = {}
+
+    for name, lines in outputs:
+        in_solution = False
+        in_depths = False
+        for line in lines:
+            if "million loops/second" in line:
+                continue # Progress
+
+            if SOLUTION.match(line):
+                in_solution = True
+                printed_count += 1
+                print("Solution %d:" % printed_count)
+                continue
+            if line.startswith(END_OF_SOLUTIONS):
+                in_solution = False
+            if in_solution:
+                print(line)
+                continue
+
+            match = SHARD.match(line)
+            if match:
+                shard = (int(match.group(1)), int(match.group(2)))
+                if shard in shards:
+                    sys.exit("%s and %s are both shard %d/%d." % (shards[shard], name, shard[0], shard[1]))
+                shards[shard] = name
+            match = FOUND.match(line)
+            if match:
+                solution_count += int(match.group(1))
+            match = FOUND_DISTINCT.match(line)
+            if match:
+                solution_count += int(match.group(1))
+                symmetric_solution_count = (symmetric_solution_count or 0) + int(match.group(2))
+            if line == "Pieces placed at each depth:":
+                in_depths = True
+                continue
+            match = DEPTH.match(line)
+            if in_depths and match:
+                depth = int(match.group(1))
+                while len(placements_at_depth) < depth:
+                    placements_at_depth.append(0)
+                placements_at_depth[depth - 1] += int(match.group(2))
+                continue
+            in_depths = False
+            match = VISITED.match(line)
+            if match:
+                nodes += int(match.group(1))
+                seconds = max(seconds, float(match.group(2)))
+
+    counts = set(count for _, count in shards)
+    if len(counts) > 1:
+        sys.exit("The outputs are from splitting the tree different numbers of ways: %s." % sorted(counts))
+    if counts:
+        count = counts.pop()
+        missing = [str(index) for index in range(1, count + 1) if (index, count) not in shards]
+        if missing:
+            print("Missing shards %s of %d: these counts are only part of the tree." % (", ".join(missing), count))
+
+    if symmetric_solution_count is None:
+        print("Found %d solutions." % solution_count)
+    else:
+        print("Found %d distinct solutions (%d counting their symmetric copies)." % (solution_count, symmetric_solution_count))
+    if placements_at_depth:
+        print("Pieces placed at each depth:")
+        for depth, placements in enumerate(placements_at_depth):
+            print("%2d: %d" % (depth + 1, placements))
+    print("Visited %d nodes in %.1f seconds (the slowest shard)." % (nodes, seconds))
+
+
+def main(paths):
+    if not paths:
+        sys.exit(__doc__.strip())
+    outputs = []
+    for path in paths:
+        with open(path) as file:
+            outputs.append((path, file.read().splitlines()))
+
+    if all(lines and lines[0] == BATCH_HEADER for _, lines in outputs):
+        merge_batch([line for _, lines in outputs for line in lines])
+    else:
+        merge_outputs(outputs)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
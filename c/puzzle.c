@@ -1,9 +1,20 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <signal.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 // #define VERIFY
 // #define DEBUG
@@ -11,8 +22,6 @@
 // #define SHOW_SOME_PROGRESS
 
 #ifdef DEBUG
-    #include <unistd.h>
-
     #define SLOW_DOWN() usleep(500000)
     #define VERIFY
     // #define VERBOSE
@@ -22,17 +31,16 @@
 
 #define RESET   "\x1b[0m"
 
-#define SPACE_WIDTH 5
-#define SPACE_HEIGHT 5
-#define SPACE_DEPTH 5
-#define SPACE_SIZE SPACE_WIDTH * SPACE_HEIGHT * SPACE_DEPTH
+#define MAX_PIECES 64
 
-#define COMMON_PIECE_SIZE 5
-// Note: rotate_piece() only works with cubes right now.
-#define SPACE_WILL_BE_FULL
+// Toggle for the check that the holes left are a multiple of the pieces' common size
+// (see are_empty_spaces_factors()). Only used when the pieces fill the whole space.
+#define CHECK_HOLE_SIZES
+
+// Comment out to fall back on the coordinate based flood fill in are_empty_spaces_factors():
+#define BITWISE_FLOOD_FILL
 
 // #define STOP_AT_FIRST_SOLUTION
-// #define TRACK_PROGRESS
 // #define DEBUG_SOLUTION
 
 
@@ -62,25 +70,53 @@ Attempt at drawing a 3 dimensional view of the axis:
 #define Z_AXIS 2
 
 #ifdef VERIFY
-    #define ASSERT_WITHIN_BOUNDS(x, y, z) if ((x) >= SPACE_WIDTH || (y) >= SPACE_HEIGHT || (z) >= SPACE_DEPTH) \
+    #define ASSERT_WITHIN_BOUNDS(x, y, z) if ((x) >= space_width || (y) >= space_height || (z) >= space_depth) \
         {printf("\nx, y, or z out of bounds (%u, %u, %u)\n\n(File %s, Line %d, in %s().\n\nTerminating!\n\n", x, y, z, __FILE__, __LINE__, __func__); exit(1);}
 #else
     #define ASSERT_WITHIN_BOUNDS(x, y, z) // Do nothing
 #endif
 
-#define PIECE_ORIENTATIONS_LIMIT 1000
+// A geom has a bit for every spot in the space (see below), so that's as big as a space
+// can be. Puzzles with more spots need a wider geom: build with -DGEOM_BITS=256 (or 512, 1024).
+#ifndef GEOM_BITS
+    #define GEOM_BITS 128
+#endif
+#define MAX_SPACE_SIZE GEOM_BITS
+
+// Enough room for every rotation and mirror image of a piece at every position:
+#define PIECE_ORIENTATIONS_LIMIT (48 * MAX_SPACE_SIZE)
 
+#if GEOM_BITS == 64
+typedef uint64_t geom;
+#elif GEOM_BITS == 128
 typedef unsigned __int128 geom;
-// Use one of the following, as per the needed bits:
-// uint_fast8_t
-// uint_fast16_t
-// uint_fast32_t
-// uint_fast64_t
-// uint128_t
-// unsigned __int128
+#else
+// Past 128 bits, a vector of 64 bit words: &, | and ~ work on all of them at once (with
+// SSE2, or AVX when enabled) and the rest goes through the geom_ functions below.
+// Only 8 byte aligned, so arrays of them can come straight from malloc().
+#define GEOM_WORDS (GEOM_BITS / 64)
+typedef uint64_t geom __attribute__((vector_size(GEOM_BITS / 8), aligned(8)));
+#endif
+#define GEOM_EMPTY ((geom){0})
 
 typedef unsigned int uint;
 
+// The puzzle being solved, set by use_puzzle():
+uint space_width;
+uint space_height;
+uint space_depth;
+uint space_size; // How many spots there are
+uint num_pieces;
+uint piece_groups[MAX_PIECES]; // Copies of the same piece share a group: the number of the first copy
+bool space_will_be_full; // The pieces add up to the whole space
+uint common_piece_size; // What the size of every piece is a multiple of
+bool check_hole_sizes; // Whether to back out when a hole can't be filled (see are_empty_spaces_factors())
+bool check_hole_sums; // The same for pieces of different sizes, with --hole-sums (see are_empty_spaces_sums())
+uint piece_sizes[MAX_PIECES];
+bool track_coverage; // Whether to count what covers each spot rather than ORing it together (see struct search)
+bool force_spots; // Whether to place the only orientation that can fill some spot first (see search_force_spot())
+bool backjump; // Whether to back out past placements that had nothing to do with a dead end (see search_next())
+
 // Bitmask to space mapping:
 //
 // x is for width
@@ -109,31 +145,354 @@ typedef unsigned int uint;
 // and counting y = 0, 1, 2 (keeping x and z at 0) gives: 0, 3, 6
 // and counting x = 0, 1, 2 (keeping y and z at 0) gives: 0, 9, 18
 
+static inline uint64_t mix64(uint64_t x){
+    // Scrambles the bits of x, so that similar xs come out nothing alike (SplitMix64's finaliser).
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+    return x ^ (x >> 31);
+}
+
+// Everything done to geoms other than &, | and ~ (and assignment), so the same code works
+// whatever their width. The narrow versions are the plain integer operations.
+
+#if GEOM_BITS <= 128
+
+static inline geom geom_bit(uint n){
+    return ((geom)1) << n;
+}
+
+static inline geom geom_from_uint64(uint64_t bits){
+    // Spots 0 through 63 from bits.
+    return (geom)bits;
+}
+
+static inline bool geom_is_empty(geom g){
+    return !g;
+}
+
+static inline bool geom_overlaps(geom a, geom b){
+    return (a & b) != 0;
+}
+
+static inline bool geom_equal(geom a, geom b){
+    return a == b;
+}
+
+static inline int geom_compare(geom a, geom b){
+    return (a > b) - (a < b);
+}
+
+static inline geom geom_lowest(geom g){
+    // Just the lowest bit set in g.
+    return g & -g;
+}
+
+static inline geom geom_without_lowest(geom g){
+    return g & (g - 1);
+}
+
+static inline geom geom_shift_up(geom g, uint n){
+    return g << n;
+}
+
+static inline geom geom_shift_down(geom g, uint n){
+    return g >> n;
+}
+
+static inline uint geom_popcount(geom g){
+    #if GEOM_BITS == 64
+    return (uint)__builtin_popcountll(g);
+    #else
+    return (uint)(__builtin_popcountll((uint64_t)g) + __builtin_popcountll((uint64_t)(g >> 64)));
+    #endif
+}
+
+static inline uint geom_ctz(geom g){
+    // The position of the lowest bit set. g can't be 0.
+    #if GEOM_BITS == 64
+    return (uint)__builtin_ctzll(g);
+    #else
+    return (uint)((uint64_t)g ? __builtin_ctzll((uint64_t)g) : 64 + __builtin_ctzll((uint64_t)(g >> 64)));
+    #endif
+}
+
+static inline uint64_t geom_hash(geom g){
+    #if GEOM_BITS == 64
+    return mix64(g);
+    #else
+    return mix64((uint64_t)g ^ mix64((uint64_t)(g >> 64)));
+    #endif
+}
+
+#else
+
+static inline geom geom_bit(uint n){
+    geom g = GEOM_EMPTY;
+    g[n / 64] = ((uint64_t)1) << (n % 64);
+    return g;
+}
+
+static inline geom geom_from_uint64(uint64_t bits){
+    geom g = GEOM_EMPTY;
+    g[0] = bits;
+    return g;
+}
+
+static inline bool geom_is_empty(geom g){
+    #if GEOM_BITS == 256 && defined(__AVX__)
+    return _mm256_testz_si256((__m256i)g, (__m256i)g);
+    #else
+    uint64_t any = 0;
+    for (uint i=0; i<GEOM_WORDS; ++i){
+        any |= g[i];
+    }
+    return !any;
+    #endif
+}
+
+static inline bool geom_overlaps(geom a, geom b){
+    #if GEOM_BITS == 256 && defined(__AVX__)
+    return !_mm256_testz_si256((__m256i)a, (__m256i)b);
+    #else
+    return !geom_is_empty(a & b);
+    #endif
+}
+
+static inline bool geom_equal(geom a, geom b){
+    return geom_is_empty(a ^ b);
+}
+
+static inline int geom_compare(geom a, geom b){
+    for (uint i=GEOM_WORDS; i-->0;){
+        if (a[i] != b[i]){
+            return a[i] > b[i] ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+static inline geom geom_lowest(geom g){
+    geom lowest = GEOM_EMPTY;
+    for (uint i=0; i<GEOM_WORDS; ++i){
+        if (g[i]){
+            lowest[i] = g[i] & -g[i];
+            break;
+        }
+    }
+    return lowest;
+}
+
+static inline geom geom_without_lowest(geom g){
+    for (uint i=0; i<GEOM_WORDS; ++i){
+        if (g[i]){
+            g[i] &= g[i] - 1;
+            break;
+        }
+    }
+    return g;
+}
+
+static inline geom geom_shift_up(geom g, uint n){
+    // Towards the higher bits. n is usually a constant so this all folds away.
+    geom output = GEOM_EMPTY;
+    uint words = n / 64;
+    uint bits = n % 64;
+    for (uint i=GEOM_WORDS; i-->words;){
+        output[i] = g[i - words] << bits;
+        if (bits && i > words){
+            output[i] |= g[i - words - 1] >> (64 - bits);
+        }
+    }
+    return output;
+}
+
+static inline geom geom_shift_down(geom g, uint n){
+    geom output = GEOM_EMPTY;
+    uint words = n / 64;
+    uint bits = n % 64;
+    for (uint i=0; i+words<GEOM_WORDS; ++i){
+        output[i] = g[i + words] >> bits;
+        if (bits && i + words + 1 < GEOM_WORDS){
+            output[i] |= g[i + words + 1] << (64 - bits);
+        }
+    }
+    return output;
+}
+
+static inline uint geom_popcount(geom g){
+    uint count = 0;
+    for (uint i=0; i<GEOM_WORDS; ++i){
+        count += (uint)__builtin_popcountll(g[i]);
+    }
+    return count;
+}
+
+static inline uint geom_ctz(geom g){
+    // The position of the lowest bit set. g can't be 0.
+    uint i = 0;
+    while (!g[i]){
+        ++i;
+    }
+    return 64 * i + (uint)__builtin_ctzll(g[i]);
+}
+
+static inline uint64_t geom_hash(geom g){
+    uint64_t hash = 0;
+    for (uint i=0; i<GEOM_WORDS; ++i){
+        hash = mix64(hash ^ g[i]);
+    }
+    return hash;
+}
+
+#endif
+
+#define X_STRIDE (space_depth * space_height)
+#define Y_STRIDE (space_depth)
+#define Z_STRIDE 1
+
+static inline uint spot_at(uint x, uint y, uint z){
+    // The bit for x, y and z (see above).
+    return x * X_STRIDE + y * Y_STRIDE + z * Z_STRIDE;
+}
+
+static inline bool geom_has_spot(geom g, uint spot){
+    return geom_overlaps(g, geom_bit(spot));
+}
+
 geom l2b(uint x, uint y, uint z){
     /*
     Converts the provided location in x, y, and z to the corresponding bit in the space.
     */
-    // return 1 << z;
     ASSERT_WITHIN_BOUNDS(x, y, z);
-    return (((geom)1) << (z + (SPACE_DEPTH * y) + (SPACE_DEPTH * SPACE_HEIGHT * x)));
+    return geom_bit(spot_at(x, y, z));
 }
 
-void print_coordinates(geom piece){
-    for (uint x=0; x<SPACE_WIDTH; ++x){
-        for (uint y=0; y<SPACE_HEIGHT; ++y){
-            for (uint z=0; z<SPACE_DEPTH; ++z){
-                if (piece & l2b(x, y, z)){
-                    printf("(%i, %i, %i)\n", x, y, z);
-                }
+// Masks of the spots that have a neighbour in the given direction. Shifting a geom by one
+// spot in some direction is then a single shift of the geom, after masking away the face
+// of the space that would otherwise wrap around into the next row/layer.
+// Populated by init_geometry().
+geom full_space_mask;
+geom has_neighbour_x_minus;
+geom has_neighbour_x_plus;
+geom has_neighbour_y_minus;
+geom has_neighbour_y_plus;
+geom has_neighbour_z_minus;
+geom has_neighbour_z_plus;
+
+// Lookup tables for the space, also populated by init_geometry(), so the rest of the code
+// can work a spot at a time (or a whole geom at a time) rather than looping over x, y and z:
+#define NO_SPOT UINT_MAX // Off the edge of the space
+uint spot_coordinates[MAX_SPACE_SIZE][3]; // The x, y and z of each spot
+geom spot_neighbours[MAX_SPACE_SIZE]; // The spots sharing a face with each spot
+geom spots_below[3][MAX_SPACE_SIZE + 1]; // [axis][n]: the spots less than n along that axis
+uint turned_spots[3][3][MAX_SPACE_SIZE]; // [axis][quarter turns - 1]: where rotate_piece() takes each spot. NO_SPOT if out of the space
+
+geom grow_into_neighbours(geom g){
+    /*
+    Returns g plus every spot that is directly next to (shares a face with) a spot in g.
+    */
+    return g
+        | geom_shift_down(g & has_neighbour_x_minus, X_STRIDE) | geom_shift_up(g & has_neighbour_x_plus, X_STRIDE)
+        | geom_shift_down(g & has_neighbour_y_minus, Y_STRIDE) | geom_shift_up(g & has_neighbour_y_plus, Y_STRIDE)
+        | geom_shift_down(g & has_neighbour_z_minus, Z_STRIDE) | geom_shift_up(g & has_neighbour_z_plus, Z_STRIDE);
+}
+
+uint turn_spot(uint spot, uint axis, uint count){
+    /*
+    Where turning the space a quarter turn around axis count times takes spot, or NO_SPOT if
+    that's out of the space (when the space isn't a cube).
+    */
+    int x = (int)spot_coordinates[spot][0];
+    int y = (int)spot_coordinates[spot][1];
+    int z = (int)spot_coordinates[spot][2];
+    for (uint r=0; r<count; ++r){
+        int turned;
+        if (axis == X_AXIS){
+            turned = y;
+            y = z;
+            z = -turned + (int)space_depth - 1;
+        } else if (axis == Y_AXIS){
+            turned = x;
+            x = z;
+            z = -turned + (int)space_depth - 1;
+        } else {
+            turned = x;
+            x = y;
+            y = -turned + (int)space_width - 1;
+        }
+    }
+    if (x < 0 || x >= (int)space_width || y < 0 || y >= (int)space_height || z < 0 || z >= (int)space_depth){
+        return NO_SPOT;
+    }
+    return spot_at((uint)x, (uint)y, (uint)z);
+}
+
+void init_geometry(){
+    uint dimensions[3] = {space_width, space_height, space_depth};
+    full_space_mask = GEOM_EMPTY;
+    has_neighbour_x_minus = GEOM_EMPTY;
+    has_neighbour_x_plus = GEOM_EMPTY;
+    has_neighbour_y_minus = GEOM_EMPTY;
+    has_neighbour_y_plus = GEOM_EMPTY;
+    has_neighbour_z_minus = GEOM_EMPTY;
+    has_neighbour_z_plus = GEOM_EMPTY;
+    memset(spots_below, 0, sizeof(spots_below));
+    for (uint spot=0; spot<space_size; ++spot){
+        uint x = spot / X_STRIDE;
+        uint y = spot / Y_STRIDE % space_height;
+        uint z = spot % space_depth;
+        spot_coordinates[spot][0] = x;
+        spot_coordinates[spot][1] = y;
+        spot_coordinates[spot][2] = z;
+
+        geom part = geom_bit(spot);
+        full_space_mask |= part;
+        if (x > 0) has_neighbour_x_minus |= part;
+        if (x < space_width-1) has_neighbour_x_plus |= part;
+        if (y > 0) has_neighbour_y_minus |= part;
+        if (y < space_height-1) has_neighbour_y_plus |= part;
+        if (z > 0) has_neighbour_z_minus |= part;
+        if (z < space_depth-1) has_neighbour_z_plus |= part;
+        for (uint axis=0; axis<3; ++axis){
+            spots_below[axis][spot_coordinates[spot][axis] + 1] |= part; // Just the layer for now
+        }
+    }
+    for (uint axis=0; axis<3; ++axis){
+        for (uint n=1; n<=dimensions[axis]; ++n){
+            spots_below[axis][n] |= spots_below[axis][n-1];
+        }
+    }
+    for (uint spot=0; spot<space_size; ++spot){
+        spot_neighbours[spot] = grow_into_neighbours(geom_bit(spot)) & ~geom_bit(spot);
+        for (uint axis=0; axis<3; ++axis){
+            for (uint count=1; count<=3; ++count){
+                turned_spots[axis][count-1][spot] = turn_spot(spot, axis, count);
             }
         }
     }
+}
+
+geom permute_spots(geom g, const uint *spots){
+    // Moves each spot in g to spots[spot]. There can't be any NO_SPOTs amongst them.
+    geom output = GEOM_EMPTY;
+    while (!geom_is_empty(g)){
+        output |= geom_bit(spots[geom_ctz(g)]);
+        g = geom_without_lowest(g);
+    }
+    return output;
+}
+
+void print_coordinates(geom piece){
+    for (; !geom_is_empty(piece); piece=geom_without_lowest(piece)){
+        uint *coordinates = spot_coordinates[geom_ctz(piece)];
+        printf("(%u, %u, %u)\n", coordinates[0], coordinates[1], coordinates[2]);
+    }
 };
 
 void _print_binary(geom number){
-    if (number){
-        _print_binary(number >> 1);
-        putc((number & 1) ? '1' : '0', stdout);
+    if (!geom_is_empty(number)){
+        _print_binary(geom_shift_down(number, 1));
+        putc(geom_overlaps(number, geom_bit(0)) ? '1' : '0', stdout);
     }
 }
 
@@ -189,10 +548,10 @@ void print_space_fill(geom space, uint fill){
             0 0 0
 
     */
-    for (uint y=0; y<SPACE_HEIGHT; ++y){
-        for (uint z=0; z<SPACE_DEPTH; ++z){
-            for (uint x=0; x<SPACE_WIDTH; ++x){
-                if (space & l2b(x, y, z)){
+    for (uint y=0; y<space_height; ++y){
+        for (uint z=0; z<space_depth; ++z){
+            for (uint x=0; x<space_width; ++x){
+                if (geom_has_spot(space, spot_at(x, y, z))){
                     printf("%u ", fill);
                 } else{
                     printf("0 ");
@@ -210,9 +569,9 @@ void print_space_simple(geom space){
 
 void _print_space(geom space, char *colour){
 
-    for (uint z=0; z<SPACE_DEPTH; ++z){
+    for (uint z=0; z<space_depth; ++z){
         printf(" ┌");
-        for (uint x=0; x<SPACE_WIDTH; ++x){
+        for (uint x=0; x<space_width; ++x){
             printf("───");
         }
         printf("┐ ");
@@ -220,11 +579,11 @@ void _print_space(geom space, char *colour){
     printf("\n");
 
 
-    for (uint z=0; z<SPACE_DEPTH; ++z){
-        for (uint y=0; y<SPACE_HEIGHT; ++y){
+    for (uint z=0; z<space_depth; ++z){
+        for (uint y=0; y<space_height; ++y){
             printf(" │");
-            for (uint x=0; x<SPACE_WIDTH; ++x){
-                if (space & l2b(x, y, z)){
+            for (uint x=0; x<space_width; ++x){
+                if (geom_has_spot(space, spot_at(x, y, z))){
                     printf(colour);
                     printf(" ■ ");
                     printf(RESET);
@@ -236,9 +595,9 @@ void _print_space(geom space, char *colour){
         }
         printf("\n");
     }
-    for (uint z=0; z<SPACE_DEPTH; ++z){
+    for (uint z=0; z<space_depth; ++z){
         printf(" └");
-        for (uint x=0; x<SPACE_WIDTH; ++x){
+        for (uint x=0; x<space_width; ++x){
             printf("───");
         }
         printf("┘ ");
@@ -271,7 +630,7 @@ void print_bits(geom space){
 
 bool piece_in_array(geom *orientations, uint orientation_count, geom piece){
     for (uint i=0; i<orientation_count; ++i){
-        if (orientations[i] == piece){
+        if (geom_equal(orientations[i], piece)){
             return true;
         }
     }
@@ -282,370 +641,763 @@ geom rotate_piece(geom piece, uint axis, uint count){
     /*
     Rotates the part count times around the specified axis.
 
+    Note: only works when the space is a cube right now.
     */
-    geom output = 0;
-
-    int old_x;
-    int old_y;
-    int old_z;
-
-    int new_x;
-    int new_y;
-    int new_z;
-
-    if (count == 0){
+    if (axis > Z_AXIS){
+        printf("Invalid axis value provided: %u.\n", axis);
+        return GEOM_EMPTY;
+    }
+    if (count % 4 == 0){
         return piece;
     }
+    const uint *spots = turned_spots[axis][count % 4 - 1];
+    for (geom left=piece; !geom_is_empty(left); left=geom_without_lowest(left)){
+        if (spots[geom_ctz(left)] == NO_SPOT){
+            printf("Failure rotating piece: goes out of bounds.\n");
+            return piece;
+        }
+    }
+    return permute_spots(piece, spots);
+}
 
-    if (axis == X_AXIS){
-        for (uint x=0; x<SPACE_WIDTH; ++x){
-            for (uint y=0; y<SPACE_HEIGHT; ++y){
-                for (uint z=0; z<SPACE_DEPTH; ++z){
-                    if (piece & l2b(x, y, z)){
+geom shift_piece(geom piece, int x_shift, int y_shift, int z_shift){
+    /*
+    Moves the piece along each axis as a single shift of the geom, or returns it as it is
+    if any of it would go out of the space.
+    */
+    int shifts[3] = {x_shift, y_shift, z_shift};
+    uint dimensions[3] = {space_width, space_height, space_depth};
+    uint strides[3] = {X_STRIDE, Y_STRIDE, Z_STRIDE};
+    int offset = 0;
+    for (uint axis=0; axis<3; ++axis){
+        uint distance = (uint)abs(shifts[axis]);
+        if (distance == 0){
+            continue;
+        }
+        if (distance >= dimensions[axis]){
+            return piece;
+        }
+        // The spots that would go over the edge:
+        geom leaving = shifts[axis] > 0 ? ~spots_below[axis][dimensions[axis] - distance] : spots_below[axis][distance];
+        if (geom_overlaps(piece, leaving)){
+            return piece;
+        }
+        offset += shifts[axis] * (int)strides[axis];
+    }
+    return offset >= 0 ? geom_shift_up(piece, (uint)offset) : geom_shift_down(piece, (uint)-offset);
+}
 
-                        new_x = (int)x;
-                        old_y = (int)y;
-                        old_z = (int)z;
+/*
+The ways of lining up the x, y and z axes with each other: the first three keep their
+handedness and the last three (swapping two axes) make mirror images of it.
+*/
+const uint axis_orders[6][3] = {{0, 1, 2}, {1, 2, 0}, {2, 0, 1}, {0, 2, 1}, {1, 0, 2}, {2, 1, 0}};
+#define AXIS_ORDERS_KEEPING_HANDEDNESS 3
 
-                        for (uint r=0; r<count; ++r){
-                            new_y = old_z;
-                            new_z = -old_y + SPACE_DEPTH - 1;
+uint populate_orientations(geom *orientations, geom piece, bool mirrors){
+    /*
+    Puts each rotation of the piece (and mirror image, with mirrors) at each place it fits in
+    the space into orientations and returns how many there are. Rotations are made by picking
+    an axis order and which axes to flip over, 24 of the 48 keeping the piece's handedness.
+    Each is moved up against the origin, so turning the piece into the same shape twice gives
+    the same geom, and from there shifted only as far as it fits.
+    */
+    uint spots[MAX_SPACE_SIZE][3];
+    uint spot_count = 0;
+    for (geom left=piece; !geom_is_empty(left); left=geom_without_lowest(left)){
+        memcpy(spots[spot_count], spot_coordinates[geom_ctz(left)], sizeof(spots[0]));
+        ++spot_count;
+    }
 
-                            old_y = new_y;
-                            old_z = new_z;
-                        }
+    uint dimensions[3] = {space_width, space_height, space_depth};
+    geom shapes[48];
+    uint shape_count = 0;
+    uint orientation_count = 0;
+    for (uint order=0; order<6; ++order){
+        for (uint flipped=0; flipped<8; ++flipped){ // One bit per axis
+            bool mirrored = (order >= AXIS_ORDERS_KEEPING_HANDEDNESS) != (__builtin_popcount(flipped) % 2 == 1);
+            if (mirrored && !mirrors){
+                continue;
+            }
 
-                        if (new_x < 0 || new_x >= SPACE_WIDTH || new_y < 0 || new_y >= SPACE_HEIGHT || new_z < 0 || new_z >= SPACE_DEPTH){
-                            printf("Failure rotating piece: goes out of bounds.\n");
-                            return piece;
-                        } else {
-                            output |= l2b((uint)new_x, (uint)new_y, (uint)new_z);
-                        }
+            // Flipping an axis over is done against the far side of the space so the spots stay
+            // positive; pulling the lowest spot on each axis back to 0 then undoes the offset:
+            uint turned[MAX_SPACE_SIZE][3];
+            uint lowest[3] = {MAX_SPACE_SIZE, MAX_SPACE_SIZE, MAX_SPACE_SIZE};
+            uint highest[3] = {0, 0, 0};
+            for (uint s=0; s<spot_count; ++s){
+                for (uint axis=0; axis<3; ++axis){
+                    uint value = spots[s][axis_orders[order][axis]];
+                    if (flipped & (1u << axis)){
+                        value = MAX_SPACE_SIZE - value;
                     }
+                    turned[s][axis] = value;
+                    lowest[axis] = value < lowest[axis] ? value : lowest[axis];
+                    highest[axis] = value > highest[axis] ? value : highest[axis];
                 }
             }
-        }
-    } else if (axis == Y_AXIS){
-        for (uint x=0; x<SPACE_WIDTH; ++x){
-            for (uint y=0; y<SPACE_HEIGHT; ++y){
-                for (uint z=0; z<SPACE_DEPTH; ++z){
-                    if (piece & l2b(x, y, z)){
-
-                        old_x = (int)x;
-                        new_y = (int)y;
-                        old_z = (int)z;
-
-                        for (uint r=0; r<count; ++r){
-                            new_x = old_z;
-                            new_z = -old_x + SPACE_DEPTH - 1;
-
-                            old_x = new_x;
-                            old_z = new_z;
-                        }
+            if (highest[0] - lowest[0] >= dimensions[0] || highest[1] - lowest[1] >= dimensions[1] || highest[2] - lowest[2] >= dimensions[2]){
+                continue; // Doesn't fit in the space this way round
+            }
+            geom shape = GEOM_EMPTY;
+            for (uint s=0; s<spot_count; ++s){
+                shape |= geom_bit(spot_at(turned[s][0] - lowest[0], turned[s][1] - lowest[1], turned[s][2] - lowest[2]));
+            }
 
-                        if (new_x < 0 || new_x >= SPACE_WIDTH || new_y < 0 || new_y >= SPACE_HEIGHT || new_z < 0 || new_z >= SPACE_DEPTH){
-                            printf("Failure rotating piece: goes out of bounds.\n");
-                            return piece;
-                        } else {
-                            output |= l2b((uint)new_x, (uint)new_y, (uint)new_z);
-                        }
+            // Symmetric pieces turn into the same shape more than once. Different shapes can
+            // never shift into the same geom since they're all up against the origin:
+            if (piece_in_array(shapes, shape_count, shape)){
+                continue;
+            }
+            shapes[shape_count] = shape;
+            ++shape_count;
+
+            for (uint x=0; x<dimensions[0] - (highest[0] - lowest[0]); ++x){
+                for (uint y=0; y<dimensions[1] - (highest[1] - lowest[1]); ++y){
+                    for (uint z=0; z<dimensions[2] - (highest[2] - lowest[2]); ++z){
+                        orientations[orientation_count] = geom_shift_up(shape, x * X_STRIDE + y * Y_STRIDE + z * Z_STRIDE);
+                        ++orientation_count;
                     }
                 }
             }
         }
-    } else if (axis == Z_AXIS){ // z axis
-        for (uint x=0; x<SPACE_WIDTH; ++x){
-            for (uint y=0; y<SPACE_HEIGHT; ++y){
-                for (uint z=0; z<SPACE_DEPTH; ++z){
-                    if (piece & l2b(x, y, z)){
+    }
+    return orientation_count;
+}
 
-                        old_x = (int)x;
-                        old_y = (int)y;
-                        new_z = (int)z;
+/*
+Puzzles: the box and the pieces to pack into it. Either the built in one (see
+builtin_puzzle()) or read from a file, one thing per line:
 
-                        for (uint r=0; r<count; ++r){
-                            new_x = old_y;
-                            new_y = -old_x + SPACE_WIDTH - 1;
+    # Lines starting with # are comments
+    box 3 3 3
+    piece 0,0,0 1,0,0 2,0,0 1,1,0
+    piece 0,0,0 1,0,0 2,0,0 x2 #ff0000 "Three in a row"
 
-                            old_x = new_x;
-                            old_y = new_y;
-                        }
+Each piece is the x,y,z of each of its spots, optionally followed by how many copies of it
+there are (x2), its colour (#rrggbb) and its name (in quotes if it has spaces).
+*/
 
-                        if (new_x < 0 || new_x >= SPACE_WIDTH || new_y < 0 || new_y >= SPACE_HEIGHT || new_z < 0 || new_z >= SPACE_DEPTH){
-                            printf("Failure rotating piece: goes out of bounds.\n");
-                            return piece;
-                        } else {
-                            output |= l2b((uint)new_x, (uint)new_y, (uint)new_z);
-                        }
-                    }
-                }
-            }
-        }
-    } else {
-        printf("Invalid axis value provided: %u.\n", axis);
+#define PIECE_NAME_LENGTH 48
+#define PIECE_COLOR_LENGTH 24
+
+struct puzzle {
+    uint width;
+    uint height;
+    uint depth;
+    uint piece_count; // Counting each copy of a piece separately
+    geom pieces[MAX_PIECES];
+    uint groups[MAX_PIECES]; // See piece_groups
+    char names[MAX_PIECES][PIECE_NAME_LENGTH];
+    char color_codes[MAX_PIECES][PIECE_COLOR_LENGTH];
+    char *colors[MAX_PIECES]; // Pointing at color_codes
+};
+
+// Pieces without a colour of their own cycle through these:
+char *default_piece_colors[] = {
+    "\e[38;2;255;180;0m",   // Light Orange
+    "\e[38;2;238;238;0m",   // Yellow
+    "\e[38;2;245;238;0m",   // Yellow
+    "\e[38;2;255;165;0m",   // Light Orange
+    "\e[38;2;238;154;0m",   // Dark Orange
+    "\e[38;2;238;145;0m",   // Dark Orange
+    "\e[38;2;238;154;0m",   // Dark Orange
+    "\e[38;2;255;0;0m",     // Red
+    "\e[38;2;255;0;20m",    // Red
+    "\e[38;2;200;0;0m",     // Dark Red
+    "\e[38;2;200;20;0m",    // Dark Red
+    "\e[38;2;142;56;142m",  // Purple
+    "\e[38;2;142;40;142m",  // Purple
+    "\e[38;2;0;0;205m",     // Blue
+    "\e[38;2;0;20;205m",    // Blue
+    "\e[38;2;0;128;128m",   // Teal
+    "\e[38;2;20;128;128m",  // Teal
+    "\e[38;2;173;255;47m",  // Yellow-Green
+    "\e[38;2;173;234;47m",  // Yellow-Green
+    "\e[38;2;154;255;154m", // Light Green
+    "\e[38;2;170;255;154m", // Light Green
+    "\e[38;2;162;205;90m",  // Olive Green
+    "\e[38;2;150;205;90m",  // Olive Green
+    "\e[38;2;0;100;0m",     // Dark Green
+    "\e[38;2;20;100;0m",    // Dark Green
+};
+#define DEFAULT_PIECE_COLOR_COUNT (sizeof(default_piece_colors) / sizeof(default_piece_colors[0]))
+
+void set_space(uint width, uint height, uint depth){
+    space_width = width;
+    space_height = height;
+    space_depth = depth;
+    space_size = width * height * depth;
+    init_geometry();
+}
+
+uint greatest_common_divisor(uint a, uint b){
+    while (b){
+        uint remainder = a % b;
+        a = b;
+        b = remainder;
     }
+    return a;
+}
 
-    return output;
+void use_puzzle(struct puzzle *p){
+    /*
+    Makes p the puzzle being solved: sets the size of the space and works out what the
+    search needs to know about the pieces.
+    */
+    set_space(p->width, p->height, p->depth);
+    num_pieces = p->piece_count;
+    uint total_size = 0;
+    common_piece_size = 0;
+    for (uint i=0; i<num_pieces; ++i){
+        uint size = geom_popcount(p->pieces[i]);
+        total_size += size;
+        common_piece_size = greatest_common_divisor(common_piece_size, size);
+        piece_groups[i] = p->groups[i];
+        piece_sizes[i] = size;
+    }
+    space_will_be_full = total_size == space_size;
+    check_hole_sizes = space_will_be_full && common_piece_size > 1;
+    check_hole_sums = false;
+    for (uint i=1; i<num_pieces; ++i){
+        check_hole_sums |= space_will_be_full && piece_sizes[i] != piece_sizes[0];
+    }
 }
 
-geom shift_piece(geom piece, int x_shift, int y_shift, int z_shift){
-    geom output = 0;
-    int new_x;
-    int new_y;
-    int new_z;
-    for (uint x=0; x<SPACE_WIDTH; ++x){
-        for (uint y=0; y<SPACE_HEIGHT; ++y){
-            for (uint z=0; z<SPACE_DEPTH; ++z){
-                // printf("Checking x=%u, y=%u, z=%u\n", x, y, z);
-                if (piece & l2b(x, y, z)){
-                    new_x = (int)x + x_shift;
-                    new_y = (int)y + y_shift;
-                    new_z = (int)z + z_shift;
-                    // printf("new x=%u, y=%u, z=%u\n", new_x, new_y, new_z);
-                    if (new_x < 0 || new_x >= SPACE_WIDTH || new_y < 0 || new_y >= SPACE_HEIGHT || new_z < 0 || new_z >= SPACE_DEPTH){
-                        // printf("Failure shifting piece: goes out of bounds.\n");
-                        return piece;
-                    }
+/*
+Copies of a piece are interchangeable, so every solution could be found once for each way
+of swapping them around. Only the one with each piece's copies in order of their lowest
+spot counts: the search only places them that way (see search_trim_orientations()).
+*/
 
-                    // printf("Adding new x, y, z to output.\n");
+bool in_copy_order(geom *placed_pieces, uint *piece_placing_history){
+    // Whether a solution (every piece placed) has the copies of each piece in order.
+    uint lowest[MAX_PIECES];
+    for (uint i=0; i<num_pieces; ++i){
+        lowest[piece_placing_history[i]] = geom_ctz(placed_pieces[i]);
+    }
+    for (uint i=1; i<num_pieces; ++i){
+        if (piece_groups[i] == piece_groups[i-1] && lowest[i] < lowest[i-1]){
+            return false;
+        }
+    }
+    return true;
+}
 
-                    output |= l2b((uint)new_x, (uint)new_y, (uint)new_z);
-                }
-            }
+void sort_copies(geom *solution){
+    // Puts the copies of each piece in a solution (indexed by piece) back in order.
+    for (uint i=1; i<num_pieces; ++i){
+        for (uint j=i; j>0 && piece_groups[j] == piece_groups[j-1] && geom_ctz(solution[j]) < geom_ctz(solution[j-1]); --j){
+            geom swap = solution[j];
+            solution[j] = solution[j-1];
+            solution[j-1] = swap;
         }
     }
+}
 
-    return output;
+bool add_piece(struct puzzle *p, geom piece, uint copies, char *name, char *color){
+    // Adds copies of piece to p. Returns false if there's no room for them.
+    if (p->piece_count + copies > MAX_PIECES){
+        return false;
+    }
+    uint first = p->piece_count;
+    for (uint c=0; c<copies; ++c){
+        uint i = p->piece_count++;
+        p->pieces[i] = piece;
+        p->groups[i] = first;
+        snprintf(p->names[i], PIECE_NAME_LENGTH, "%s", name);
+        snprintf(p->color_codes[i], PIECE_COLOR_LENGTH, "%s", color ? color : default_piece_colors[i % DEFAULT_PIECE_COLOR_COUNT]);
+        p->colors[i] = p->color_codes[i];
+    }
+    return true;
 }
 
-uint populate_orientations(geom *orientations, geom piece){
-    geom new_piece;
-    // uint orientation_attempts = 0;
-    uint orientation_count = 0;
-    for (uint axis=0; axis<3; ++axis){
-        for (uint rotation=0; rotation<4; ++rotation){
-            for (int x_shift=-(SPACE_WIDTH-1); x_shift<(SPACE_WIDTH); ++x_shift){
-                for (int y_shift=-(SPACE_HEIGHT-1); y_shift<(SPACE_HEIGHT); ++y_shift){
-                    for (int z_shift=-(SPACE_DEPTH-1); z_shift<(SPACE_DEPTH); ++z_shift){
-                        // printf("z_shift=%i, y_shift=%i, x_shift=%i, rotation=%u, axis=%u:\n", z_shift, y_shift, x_shift, rotation, axis);
-
-                        // printf("\nz_shift=%i, y_shift=%i, x_shift=%i, rotation=%u, axis=%u:\n", z_shift, y_shift, x_shift, rotation, axis);
-                        // printf("Making piece %u.\n", ++orientation_attempts);
-
-                        // SLOW_DOWN();
-
-                        new_piece = shift_piece(rotate_piece(piece, axis, rotation), x_shift, y_shift, z_shift);
-                        if (piece_in_array(orientations, orientation_count, new_piece)){
-                            // printf("Same piece. \n");
-                            // getchar();
-                            continue;
-                        } else {
-                            // printf("z_shift=%i, y_shift=%i, x_shift=%i, rotation=%u, axis=%u:", z_shift, y_shift, x_shift, rotation, axis);
-
-                            // printf("\nNew piece:\n");
-                            // print_space(new_piece);
-                            // getchar();
-                            orientations[orientation_count] = new_piece;
-                            ++orientation_count;
-                            if (orientation_count >= PIECE_ORIENTATIONS_LIMIT){
-                                return orientation_count;
-                            }
+void builtin_puzzle(struct puzzle *p){
+    /*
+    The puzzle solved when no puzzle file is given: 25 pentacubes in a 5 x 5 x 5 box.
+    */
+    p->width = 5;
+    p->height = 5;
+    p->depth = 5;
+    p->piece_count = 0;
+    set_space(p->width, p->height, p->depth); // For l2b()
+
+    geom pieces[] = {
+        l2b(0,0,0) | l2b(0,0,1) | l2b(0,0,2) | l2b(0,0,3) | l2b(0,0,4),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,1,0) | l2b(3,1,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(0,1,0) | l2b(0,2,0) | l2b(1,2,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(0,1,0) | l2b(0,2,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(1,0,1) | l2b(2,0,1),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,1,0) | l2b(2,1,1),
+        l2b(0,0,0) | l2b(0,0,1) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,1,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(1,1,0) | l2b(1,2,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(2,1,0) | l2b(2,2,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,1,0) | l2b(2,0,1),
+        l2b(0,0,0) | l2b(0,1,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,0,1),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(3,0,0) | l2b(3,1,0),
+        l2b(0,1,0) | l2b(1,1,0) | l2b(2,1,0) | l2b(1,0,0) | l2b(1,2,0),
+        l2b(0,0,0) | l2b(0,0,1) | l2b(1,0,0) | l2b(1,1,0) | l2b(1,1,1),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(1,1,0) | l2b(2,0,1),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(2,0,0) | l2b(2,1,0),
+        l2b(0,0,0) | l2b(0,1,0) | l2b(1,1,0) | l2b(2,1,0) | l2b(2,2,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(1,0,1) | l2b(2,0,1) | l2b(2,1,1),
+        l2b(0,0,0) | l2b(0,0,1) | l2b(1,0,0) | l2b(1,1,0) | l2b(2,1,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(1,0,1) | l2b(2,0,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(1,0,1) | l2b(2,1,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(3,0,0) | l2b(2,1,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(1,2,0) | l2b(2,1,0),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(0,1,0) | l2b(1,1,0) | l2b(1,1,1),
+        l2b(0,0,0) | l2b(1,0,0) | l2b(1,0,1) | l2b(1,1,0) | l2b(2,1,0),
+    };
+    char *names[] = {
+        "Chocolate Bar", "", "U", "Symetric L", "Y-ish", "L with hook off short end", "L with hook off long end",
+        "T", "W", "L with hook off corner", "L with hook off long end", "L", "Cross", "Two towers",
+        "L with hook off middle of long end", "Foam finger", "Z", "Left-handed", "Right-handed", "Bent Cross",
+        "L with hook off middle of long end", "Rifle", "Y-ish", "Base and tower", "Y-ish",
+    };
+    for (uint i=0; i<sizeof(pieces)/sizeof(pieces[0]); ++i){
+        add_piece(p, pieces[i], 1, names[i], NULL);
+    }
+}
+
+char *next_token(char **cursor, bool *quoted){
+    /*
+    Splits off the next word of a line (or "quoted words"), moving *cursor past it.
+    Returns NULL at the end of the line.
+    */
+    char *token = *cursor + strspn(*cursor, " \t\r\n");
+    if (*token == '\0'){
+        return NULL;
+    }
+    *quoted = *token == '"';
+    char *end;
+    if (*quoted){
+        ++token;
+        end = strchr(token, '"');
+        if (!end){
+            end = token + strlen(token);
+        }
+    } else {
+        end = token + strcspn(token, " \t\r\n");
+    }
+    *cursor = *end ? end + 1 : end;
+    *end = '\0';
+    return token;
+}
+
+bool read_puzzle(FILE *file, const char *file_name, struct puzzle *p){
+    /*
+    Reads a puzzle in the format above into p. Prints what's wrong and returns false if
+    it can't.
+    */
+    p->width = 0;
+    p->piece_count = 0;
+    uint total_size = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    uint line_number = 0;
+    bool ok = true;
+    while (ok && getline(&line, &line_capacity, file) != -1){
+        ++line_number;
+        char *cursor = line;
+        bool quoted;
+        char *keyword = next_token(&cursor, &quoted);
+        if (!keyword || (!quoted && keyword[0] == '#')){
+            continue;
+        }
+
+        if (strcmp(keyword, "box") == 0){
+            char extra;
+            if (sscanf(cursor, "%u %u %u %c", &p->width, &p->height, &p->depth, &extra) != 3
+                    || !p->width || !p->height || !p->depth){
+                printf("%s:%u: Expected the width, height and depth of the box.\n", file_name, line_number);
+                ok = false;
+            } else if (p->width * p->height * p->depth > MAX_SPACE_SIZE){
+                printf("%s:%u: The box has %u spots but geoms only have %u bits: rebuild with a bigger -DGEOM_BITS.\n",
+                    file_name, line_number, p->width * p->height * p->depth, MAX_SPACE_SIZE);
+                ok = false;
+            }
+        } else if (strcmp(keyword, "piece") == 0){
+            if (!p->width){
+                printf("%s:%u: The box has to come before the pieces.\n", file_name, line_number);
+                ok = false;
+                break;
+            }
+            geom piece = GEOM_EMPTY;
+            uint copies = 1;
+            char *name = "";
+            char color[PIECE_COLOR_LENGTH] = "";
+            char *token;
+            while (ok && (token = next_token(&cursor, &quoted))){
+                uint x, y, z;
+                uint red, green, blue;
+                char extra;
+                if (quoted){
+                    name = token;
+                } else if (strchr(token, ',')){
+                    if (sscanf(token, "%u,%u,%u%c", &x, &y, &z, &extra) != 3){
+                        printf("%s:%u: Can't read spot \"%s\": expected x,y,z.\n", file_name, line_number, token);
+                        ok = false;
+                    } else if (x >= p->width || y >= p->height || z >= p->depth){
+                        printf("%s:%u: Spot %s is outside the box.\n", file_name, line_number, token);
+                        ok = false;
+                    } else {
+                        // The same bit as l2b() once the puzzle is in use:
+                        geom spot = geom_bit(z + p->depth * (y + p->height * x));
+                        if (geom_overlaps(piece, spot)){
+                            printf("%s:%u: Spot %s is in the piece twice.\n", file_name, line_number, token);
+                            ok = false;
                         }
+                        piece |= spot;
+                    }
+                } else if (token[0] == '#'){
+                    if (strlen(token) != 7 || sscanf(token + 1, "%2x%2x%2x%c", &red, &green, &blue, &extra) != 3){
+                        printf("%s:%u: Can't read colour \"%s\": expected #rrggbb.\n", file_name, line_number, token);
+                        ok = false;
+                    } else {
+                        snprintf(color, PIECE_COLOR_LENGTH, "\e[38;2;%u;%u;%um", red, green, blue);
+                    }
+                } else if (token[0] == 'x' && token[1] && strspn(token + 1, "0123456789") == strlen(token + 1)){
+                    copies = (uint)strtoul(token + 1, NULL, 10);
+                    if (copies == 0){
+                        printf("%s:%u: A piece needs at least one copy.\n", file_name, line_number);
+                        ok = false;
                     }
+                } else {
+                    name = token;
                 }
-
             }
+            if (!ok){
+                break;
+            }
+            if (geom_is_empty(piece)){
+                printf("%s:%u: The piece has no spots.\n", file_name, line_number);
+                ok = false;
+            } else if (!add_piece(p, piece, copies, name, color[0] ? color : NULL)){
+                printf("%s:%u: Too many pieces: at most %u (counting copies).\n", file_name, line_number, MAX_PIECES);
+                ok = false;
+            }
+            total_size += copies * geom_popcount(piece);
+        } else {
+            printf("%s:%u: Expected a box or a piece, not \"%s\".\n", file_name, line_number, keyword);
+            ok = false;
         }
     }
-    return orientation_count;
+    free(line);
+
+    if (ok && (!p->width || p->piece_count == 0)){
+        printf("%s: Needs a box and at least one piece.\n", file_name);
+        ok = false;
+    }
+    if (ok && total_size > p->width * p->height * p->depth){
+        printf("%s: The pieces have %u spots between them, more than the %u in the box.\n", file_name, total_size,
+            p->width * p->height * p->depth);
+        ok = false;
+    }
+    return ok;
+}
+
+bool load_puzzle(const char *path, struct puzzle *p){
+    FILE *file = fopen(path, "r");
+    if (!file){
+        printf("Can't open puzzle file %s.\n", path);
+        return false;
+    }
+    bool ok = read_puzzle(file, path, p);
+    fclose(file);
+    return ok;
 }
 
 volatile sig_atomic_t keep_running = 1;
 volatile sig_atomic_t print_status = 0;
+volatile sig_atomic_t save_checkpoint = 0;
+volatile sig_atomic_t dump_stats = 0;
 
 static void sig_handler(int signum)
 {
     switch (signum){
         case SIGUSR1:
             print_status = 1;
+            save_checkpoint = 1;
+            dump_stats = 1;
             break;
         default:
             keep_running = 0;
     }
 }
 
-#ifdef COMMON_PIECE_SIZE
-bool are_empty_spaces_factors(geom space){
-    uint num_connected_holes;
-    geom connected_holes = 0;
-
-    uint holes_to_check_index;
-    uint holes_to_check[SPACE_SIZE][3] = {{0}};
-
-    geom part;
+#ifdef CHECK_HOLE_SIZES
+bool are_empty_spaces_factors_dfs(geom space, uint *regions){
+    /*
+    Checks that each group of connected holes in the space has a multiple of
+    common_piece_size spots, visiting the holes one by one, depth first. Sets *regions to
+    how many groups it got through (all of them if it returns true).
+    */
+    geom holes = ~space & full_space_mask;
+    uint holes_to_check[MAX_SPACE_SIZE];
+
+    *regions = 0;
+    while (!geom_is_empty(holes)){
+        ++*regions;
+        uint num_connected_holes = 0;
+        uint holes_to_check_index = 0;
+        holes_to_check[holes_to_check_index++] = geom_ctz(holes); // Starting from the lowest hole
+        holes = geom_without_lowest(holes);
+
+        while (holes_to_check_index > 0){
+            uint hole = holes_to_check[--holes_to_check_index];
+            ++num_connected_holes;
+            for (geom next=spot_neighbours[hole] & holes; !geom_is_empty(next); next=geom_without_lowest(next)){
+                uint neighbour = geom_ctz(next);
+                holes &= ~geom_bit(neighbour); // So it's only checked once
+                holes_to_check[holes_to_check_index++] = neighbour;
+            }
+        }
 
-    uint current_x;
-    uint current_y;
-    uint current_z;
+        if (num_connected_holes % common_piece_size != 0){
+            return false;
+        }
+    }
+    return true;
+}
 
-    uint alt_x;
-    uint alt_y;
-    uint alt_z;
+bool are_empty_spaces_factors_bitwise(geom space, uint *regions){
+    /*
+    Same as are_empty_spaces_factors_dfs() but grows each group of connected holes a whole
+    layer at a time with grow_into_neighbours() instead of visiting spots one by one.
+    */
+    geom holes = ~space & full_space_mask;
+
+    *regions = 0;
+    while (!geom_is_empty(holes)){
+        ++*regions;
+        geom connected_holes = geom_lowest(holes); // Starting from the lowest hole
+        geom grown;
+        while (!geom_equal(grown = grow_into_neighbours(connected_holes) & holes, connected_holes)){
+            connected_holes = grown;
+        }
 
-    space = ~space; // Because we want to find holes
+        if (geom_popcount(connected_holes) % common_piece_size != 0){
+            return false;
+        }
+        holes &= ~connected_holes;
+    }
+    return true;
+}
 
+bool are_empty_spaces_sums(geom space, geom sums, uint *regions){
+    /*
+    Checks that each group of connected holes in the space has a number of spots that some
+    of the pieces left add up to: bit n of sums is set if some of them add up to n (see
+    subset_sums()). With pieces of different sizes, holes can be filled with all sorts of
+    numbers of spots, but not every number. Sets *regions like are_empty_spaces_factors().
+    */
+    geom holes = ~space & full_space_mask;
+
+    *regions = 0;
+    while (!geom_is_empty(holes)){
+        ++*regions;
+        geom connected_holes = geom_lowest(holes);
+        geom grown;
+        while (!geom_equal(grown = grow_into_neighbours(connected_holes) & holes, connected_holes)){
+            connected_holes = grown;
+        }
 
-    for (uint x=0; x<SPACE_WIDTH; ++x){
-        for (uint y=0; y<SPACE_HEIGHT; ++y){
-            for (uint z=0; z<SPACE_DEPTH; ++z){
-                part = l2b(x, y, z);
-                if ((space & part) && !(connected_holes & part)){ // If it's a hole in the space and we haven't already found this hole
-                    num_connected_holes = 0;
-
-                    holes_to_check_index = 0;
+        if (!geom_overlaps(sums, geom_bit(geom_popcount(connected_holes)))){
+            return false;
+        }
+        holes &= ~connected_holes;
+    }
+    return true;
+}
 
-                    ++num_connected_holes;
-                    connected_holes |= part;
+geom subset_sums(uint *orientation_counts){
+    /*
+    The numbers of spots the pieces not placed yet (those with orientations left) can add
+    up to, as a bit for each: adding each piece's size to every sum so far, a shift at a
+    time.
+    */
+    geom sums = geom_bit(0);
+    for (uint i=0; i<num_pieces; ++i){
+        if (orientation_counts[i]){
+            sums |= geom_shift_up(sums, piece_sizes[i]);
+        }
+    }
+    return sums;
+}
 
-                    holes_to_check[holes_to_check_index][0] = x;
-                    holes_to_check[holes_to_check_index][1] = y;
-                    holes_to_check[holes_to_check_index][2] = z;
-                    ++holes_to_check_index;
+#ifdef BITWISE_FLOOD_FILL
+    #define are_empty_spaces_factors are_empty_spaces_factors_bitwise
+#else
+    #define are_empty_spaces_factors are_empty_spaces_factors_dfs
+#endif
+#endif
 
-                    while (holes_to_check_index > 0){
 
-                        --holes_to_check_index;
-                        current_x = holes_to_check[holes_to_check_index][0];
-                        current_y = holes_to_check[holes_to_check_index][1];
-                        current_z = holes_to_check[holes_to_check_index][2];
+/*
+Filtering orientations, the bulk of the work in the search: moves the orientations that
+don't overlap space to the front of orientations[0..count), in the same order, and the
+ones that do behind them. Returns how many don't overlap, ORing them into *fill.
+overlapping is scratch space for count geoms.
+
+For 128 bit geoms on x86 there are SSE2 and AVX2 versions that don't branch on each
+orientation: every orientation is stored both as kept and as overlapping, and only the
+right one's position moves on. init_filter_orientations() picks the best one the CPU
+supports.
+*/
 
-                        if (current_x > 0){
-                            alt_x = current_x - 1;
-                            part = l2b(alt_x, current_y, current_z);
-                            if ((space & part) && !(connected_holes & part)){ // If it's a hole in the space and we haven't already found this hole
-                                ++num_connected_holes;
-                                connected_holes |= part;
+uint filter_orientations_plain(geom *orientations, uint count, geom space, geom *fill, geom *overlapping){
+    uint kept = 0;
+    uint dropped = 0;
+    geom kept_fill = *fill;
+    for (uint i=0; i<count; ++i){
+        geom orientation = orientations[i];
+        if (!geom_overlaps(space, orientation)){
+            orientations[kept++] = orientation;
+            kept_fill |= orientation;
+        } else {
+            overlapping[dropped++] = orientation;
+        }
+    }
+    memcpy(orientations + kept, overlapping, dropped * sizeof(geom));
+    *fill = kept_fill;
+    return kept;
+}
 
-                                holes_to_check[holes_to_check_index][0] = alt_x;
-                                holes_to_check[holes_to_check_index][1] = current_y;
-                                holes_to_check[holes_to_check_index][2] = current_z;
-                                ++holes_to_check_index;
-                            }
-                        }
-                        alt_x = current_x + 1;
-                        if (alt_x < SPACE_WIDTH){
-                            part = l2b(alt_x, current_y, current_z);
-                            if ((space & part) && !(connected_holes & part)){ // If it's a hole in the space and we haven't already found this hole
-                                ++num_connected_holes;
-                                connected_holes |= part;
-
-                                holes_to_check[holes_to_check_index][0] = alt_x;
-                                holes_to_check[holes_to_check_index][1] = current_y;
-                                holes_to_check[holes_to_check_index][2] = current_z;
-                                ++holes_to_check_index;
-                            }
-                        }
+#if defined(__x86_64__) && GEOM_BITS == 128
+#define FILTER_ORIENTATIONS_SIMD
+
+uint filter_orientations_sse2(geom *orientations, uint count, geom space, geom *fill, geom *overlapping){
+    __m128i space1 = _mm_loadu_si128((const __m128i *)&space);
+    __m128i zero = _mm_setzero_si128();
+    __m128i kept_fill = _mm_loadu_si128((const __m128i *)fill);
+    geom *kept = orientations;
+    geom *dropped = overlapping;
+    for (uint i=0; i<count; ++i){
+        __m128i orientation = _mm_loadu_si128((const __m128i *)(orientations + i));
+        __m128i clear = _mm_cmpeq_epi32(_mm_and_si128(orientation, space1), zero);
+        uint keep = _mm_movemask_epi8(clear) == 0xFFFF;
+        kept_fill = _mm_or_si128(kept_fill, _mm_and_si128(orientation, _mm_set1_epi32(-(int)keep)));
+        _mm_storeu_si128((__m128i *)kept, orientation);
+        _mm_storeu_si128((__m128i *)dropped, orientation);
+        kept += keep;
+        dropped += 1 - keep;
+    }
+    uint kept_count = (uint)(kept - orientations);
+    memcpy(kept, overlapping, (count - kept_count) * sizeof(geom));
+    _mm_storeu_si128((__m128i *)fill, kept_fill);
+    return kept_count;
+}
 
-                        if (current_y > 0){
-                            alt_y = current_y-1;
-                            part = l2b(current_x, alt_y, current_z);
-                            if ((space & part) && !(connected_holes & part)){ // If it's a hole in the space and we haven't already found this hole
-                                ++num_connected_holes;
-                                connected_holes |= part;
-
-                                holes_to_check[holes_to_check_index][0] = current_x;
-                                holes_to_check[holes_to_check_index][1] = alt_y;
-                                holes_to_check[holes_to_check_index][2] = current_z;
-                                ++holes_to_check_index;
-                            }
-                        }
-                        alt_y = current_y + 1;
-                        if (alt_y < SPACE_HEIGHT){
-                            part = l2b(current_x, alt_y, current_z);
-                            if ((space & part) && !(connected_holes & part)){ // If it's a hole in the space and we haven't already found this hole
-                                ++num_connected_holes;
-                                connected_holes |= part;
-
-                                holes_to_check[holes_to_check_index][0] = current_x;
-                                holes_to_check[holes_to_check_index][1] = alt_y;
-                                holes_to_check[holes_to_check_index][2] = current_z;
-                                ++holes_to_check_index;
-                            }
-                        }
+__attribute__((target("avx2")))
+uint filter_orientations_avx2(geom *orientations, uint count, geom space, geom *fill, geom *overlapping){
+    // Two orientations per register. Each pair is stored whole as kept and as overlapping,
+    // with its halves swapped first if only the second one belongs there.
+    __m256i in_order = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i space2 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&space));
+    __m256i zero = _mm256_setzero_si256();
+    __m256i kept_fill = zero;
+    geom *kept = orientations;
+    geom *dropped = overlapping;
+    uint i = 0;
+    for (; i+2<=count; i+=2){
+        __m256i pair = _mm256_loadu_si256((const __m256i *)(orientations + i));
+        // A 64 bit half is all ones if it's clear, then both halves have to be:
+        __m256i clear = _mm256_cmpeq_epi64(_mm256_and_si256(pair, space2), zero);
+        clear = _mm256_and_si256(clear, _mm256_shuffle_epi32(clear, _MM_SHUFFLE(1, 0, 3, 2)));
+        kept_fill = _mm256_or_si256(kept_fill, _mm256_and_si256(pair, clear));
+        uint keep = (uint)_mm256_movemask_pd(_mm256_castsi256_pd(clear));
+        uint keep_first = keep & 1;
+        uint keep_second = (keep >> 2) & 1;
+        __m256i kept_order = _mm256_xor_si256(in_order, _mm256_set1_epi32((int)(4 - 4 * keep_first)));
+        _mm256_storeu_si256((__m256i *)kept, _mm256_permutevar8x32_epi32(pair, kept_order));
+        _mm256_storeu_si256((__m256i *)dropped, _mm256_permutevar8x32_epi32(pair, _mm256_xor_si256(kept_order, _mm256_set1_epi32(4))));
+        kept += keep_first + keep_second;
+        dropped += 2 - keep_first - keep_second;
+    }
+    __m128i fill1 = _mm_or_si128(_mm256_castsi256_si128(kept_fill), _mm256_extracti128_si256(kept_fill, 1));
+    fill1 = _mm_or_si128(fill1, _mm_loadu_si128((const __m128i *)fill));
+    _mm_storeu_si128((__m128i *)fill, fill1);
+    if (i < count){
+        geom orientation = orientations[i];
+        if (!geom_overlaps(space, orientation)){
+            *kept++ = orientation;
+            *fill |= orientation;
+        } else {
+            *dropped++ = orientation;
+        }
+    }
+    uint kept_count = (uint)(kept - orientations);
+    memcpy(kept, overlapping, (count - kept_count) * sizeof(geom));
+    return kept_count;
+}
+#endif
 
-                        if (current_z > 0){
-                            alt_z = current_z-1;
-                            part = l2b(current_x, current_y, alt_z);
-                            if ((space & part) && !(connected_holes & part)){ // If it's a hole in the space and we haven't already found this hole
-                                ++num_connected_holes;
-                                connected_holes |= part;
-
-                                holes_to_check[holes_to_check_index][0] = current_x;
-                                holes_to_check[holes_to_check_index][1] = current_y;
-                                holes_to_check[holes_to_check_index][2] = alt_z;
-                                ++holes_to_check_index;
-                            }
-                        }
-                        alt_z = current_z + 1;
-                        if (alt_z < SPACE_DEPTH){
-                            part = l2b(current_x, current_y, alt_z);
-                            if ((space & part) && !(connected_holes & part)){ // If it's a hole in the space and we haven't already found this hole
-                                ++num_connected_holes;
-                                connected_holes |= part;
-
-                                holes_to_check[holes_to_check_index][0] = current_x;
-                                holes_to_check[holes_to_check_index][1] = current_y;
-                                holes_to_check[holes_to_check_index][2] = alt_z;
-                                ++holes_to_check_index;
-                            }
-                        }
-                    }
+typedef uint (*filter_kernel)(geom *orientations, uint count, geom space, geom *fill, geom *overlapping);
+filter_kernel filter_orientations = filter_orientations_plain;
 
+struct filter_kernel_option {
+    char *name;
+    filter_kernel kernel;
+};
 
-                    if (num_connected_holes % COMMON_PIECE_SIZE != 0){
-                        return false;
-                    }
-                }
-            }
-        }
+uint available_filter_kernels(struct filter_kernel_option *options){
+    // The filter kernels this CPU can run, slowest first. Returns how many.
+    uint count = 0;
+    options[count++] = (struct filter_kernel_option){"plain", filter_orientations_plain};
+    #ifdef FILTER_ORIENTATIONS_SIMD
+    options[count++] = (struct filter_kernel_option){"sse2", filter_orientations_sse2};
+    if (__builtin_cpu_supports("avx2")){
+        options[count++] = (struct filter_kernel_option){"avx2", filter_orientations_avx2};
     }
-    return true;
+    #endif
+    return count;
+}
+
+void init_filter_orientations(){
+    struct filter_kernel_option options[3];
+    uint count = available_filter_kernels(options);
+    filter_orientations = options[count - 1].kernel;
 }
-#endif
 
 
-#define assertGeomEqual(value1, value2, message) do { if (!((value1) == (value2))){ printf("\nfailed: %u != %u    %s", value1, value2, message); ++failures;}} while (0)
+#define assertGeomEqual(value1, value2, message) do { if (!geom_equal((value1), (value2))){ printf("\nfailed: %u != %u    %s", value1, value2, message); ++failures;}} while (0)
 #define assertFalse(value, message) do { if (value){ printf("\nfailed: %u is true    %s", value, message); ++failures;}} while (0)
 #define assertTrue(value, message) do { if (!(value)){ printf("\nfailed: %u is false    %s", value, message); ++failures;}} while (0)
-#define assertGeomIn(value, array, length, message) do {bool match = false; for (uint _assertGeomIn_i=0; _assertGeomIn_i<length; ++_assertGeomIn_i){if ((value) == (array[_assertGeomIn_i])){match = true; break;}}; if (!match){ printf("\nfailed: %u is not in the array    %s", value, message);}} while (0)
+#define assertGeomIn(value, array, length, message) do {bool match = false; for (uint _assertGeomIn_i=0; _assertGeomIn_i<length; ++_assertGeomIn_i){if (geom_equal((value), (array[_assertGeomIn_i]))){match = true; break;}}; if (!match){ printf("\nfailed: %u is not in the array    %s", value, message);}} while (0)
 
 uint test(){
     uint failures = 0;
 
-    if (SPACE_WIDTH > 0 && SPACE_HEIGHT > 0 && SPACE_DEPTH > 0){
+    // In the built in puzzle's space, or a smaller one if it doesn't fit in a geom:
+    uint test_size = MAX_SPACE_SIZE >= 125 ? 5 : 4;
+    set_space(test_size, test_size, test_size);
+    common_piece_size = 5;
 
-        assertGeomEqual(l2b(0, 0, 0), 1, "l2b 0");
-        assertGeomEqual(l2b(0, 0, 1), 2, "l2b one z");
+    if (space_width > 0 && space_height > 0 && space_depth > 0){
 
-        assertGeomEqual(l2b(0, 0, 0), 0b1, "l2b 0 binary");
-        assertGeomEqual(l2b(0, 0, 1), 0b10, "l2b one z binary");
+        assertGeomEqual(l2b(0, 0, 0), geom_from_uint64(1), "l2b 0");
+        assertGeomEqual(l2b(0, 0, 1), geom_from_uint64(2), "l2b one z");
 
-        assertGeomEqual(l2b(0, 0, 0), 1 << 0, "l2b 0 bit shift");
-        assertGeomEqual(l2b(0, 0, 1), 1 << 1, "l2b one z bit shift");
+        assertGeomEqual(l2b(0, 0, 0), geom_from_uint64(0b1), "l2b 0 binary");
+        assertGeomEqual(l2b(0, 0, 1), geom_from_uint64(0b10), "l2b one z binary");
 
-        if (SPACE_DEPTH == 3){
-            assertGeomEqual(l2b(0, 1, 0), 0b1000, "l2b one y");
+        assertGeomEqual(l2b(0, 0, 0), geom_from_uint64(1 << 0), "l2b 0 bit shift");
+        assertGeomEqual(l2b(0, 0, 1), geom_from_uint64(1 << 1), "l2b one z bit shift");
+
+        if (space_depth == 3){
+            assertGeomEqual(l2b(0, 1, 0), geom_from_uint64(0b1000), "l2b one y");
         }
-        if (SPACE_DEPTH == 3 && SPACE_HEIGHT == 3){
-            assertGeomEqual(l2b(1, 0, 0), 0b1000000000, "l2b one x");
-            assertGeomEqual(l2b(1, 1, 1), 0b10000000000000, "l2b one x, y, and z");
+        if (space_depth == 3 && space_height == 3){
+            assertGeomEqual(l2b(1, 0, 0), geom_from_uint64(0b1000000000), "l2b one x");
+            assertGeomEqual(l2b(1, 1, 1), geom_from_uint64(0b10000000000000), "l2b one x, y, and z");
         }
 
         uint array_len = 3;
-        geom array[3] = {0b001, 0b010, 0b011};
+        geom array[3] = {geom_from_uint64(0b001), geom_from_uint64(0b010), geom_from_uint64(0b011)};
 
-        assertFalse(piece_in_array(array, array_len, 0b100), "piece not in array");
-        assertTrue(piece_in_array(array, array_len, 0b010), "piece in array");
+        assertFalse(piece_in_array(array, array_len, geom_from_uint64(0b100)), "piece not in array");
+        assertTrue(piece_in_array(array, array_len, geom_from_uint64(0b010)), "piece in array");
 
         assertGeomEqual(shift_piece(l2b(0, 0, 0), 0, 0, 0), l2b(0, 0, 0), "No shifting.");
         assertGeomEqual(shift_piece(l2b(0, 0, 0), 1, 0, 0), l2b(1, 0, 0), "Shift by one.");
@@ -660,712 +1412,4018 @@ uint test(){
 
         assertGeomEqual(shift_piece(l2b(1, 0, 0) | l2b(1, 0, 1), -1, 1, 0), l2b(0, 1, 0) | l2b(0, 1, 1), "Shift multiple locations.");
 
-        assertGeomEqual(shift_piece(l2b(1, 0, 0), SPACE_WIDTH, 0, 0), l2b(1, 0, 0),
+        assertGeomEqual(shift_piece(l2b(1, 0, 0), (int)space_width, 0, 0), l2b(1, 0, 0),
             "Shift past edge of space in positive direction.");
-        assertGeomEqual(shift_piece(l2b(SPACE_WIDTH-1, 0, 0), 1, 1, 0), l2b(SPACE_WIDTH-1, 0, 0),
+        assertGeomEqual(shift_piece(l2b(space_width-1, 0, 0), 1, 1, 0), l2b(space_width-1, 0, 0),
             "Shift past edge of space in positive direction (should return same geom).");
         assertGeomEqual(shift_piece(l2b(0, 0, 0), -1, 0, 0), l2b(0, 0, 0),
             "Shift past edge of space in negative direction.");
 
-        if (SPACE_DEPTH == 3 && SPACE_HEIGHT == 3 && SPACE_DEPTH == 3){
-            assertGeomEqual(rotate_piece(l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 0, 1) | l2b(0, 0, 2), Y_AXIS, 1),
-                l2b(0, 0, 0) | l2b(1, 0, 2) | l2b(2, 0, 2) | l2b(0, 0, 1) | l2b(0, 0, 2), "Rotate by one y.");
-
-            assertGeomEqual(rotate_piece(l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 0, 1) | l2b(0, 0, 2), Y_AXIS, 2),
-                l2b(2, 0, 2) | l2b(1, 0, 2) | l2b(2, 0, 0) | l2b(2, 0, 1) | l2b(0, 0, 2), "Rotate by two y.");
+        // Testing rotate_piece and populate_orientations, in a 3 x 3 x 3 space:
+        set_space(3, 3, 3);
+        geom test_piece = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 0, 1) | l2b(0, 0, 2);
+
+        assertGeomEqual(rotate_piece(test_piece, Y_AXIS, 1), l2b(0, 0, 0) | l2b(1, 0, 2) | l2b(2, 0, 2) | l2b(0, 0, 1) | l2b(0, 0, 2), "Rotate by one y.");
+        assertGeomEqual(rotate_piece(test_piece, Y_AXIS, 2), l2b(2, 0, 2) | l2b(1, 0, 2) | l2b(2, 0, 0) | l2b(2, 0, 1) | l2b(0, 0, 2), "Rotate by two y.");
+        assertGeomEqual(rotate_piece(test_piece, X_AXIS, 1), l2b(0, 0, 2) | l2b(1, 0, 2) | l2b(2, 0, 2) | l2b(0, 1, 2) | l2b(0, 2, 2), "Rotate by one x.");
+        assertGeomEqual(rotate_piece(test_piece, X_AXIS, 2), l2b(0, 2, 0) | l2b(1, 2, 2) | l2b(2, 2, 2) | l2b(0, 2, 1) | l2b(0, 2, 2), "Rotate by two x.");
+        assertGeomEqual(rotate_piece(test_piece, Z_AXIS, 1), l2b(0, 2, 0) | l2b(0, 1, 0) | l2b(0, 0, 0) | l2b(0, 2, 1) | l2b(0, 2, 2), "Rotate by one z.");
+        assertGeomEqual(rotate_piece(test_piece, Z_AXIS, 4), test_piece, "Four quarter turns go all the way round.");
+        assertTrue(geom_popcount(spot_neighbours[spot_at(0, 0, 0)]) == 3 && geom_popcount(spot_neighbours[spot_at(1, 1, 1)]) == 6,
+            "A corner has 3 neighbours and the middle has 6.");
+        assertGeomEqual(shift_piece(test_piece, 0, 2, 0), shift_piece(shift_piece(test_piece, 0, 1, 0), 0, 1, 0), "Shifting twice by one is shifting by two.");
+        assertGeomEqual(shift_piece(test_piece, 0, 0, 1), test_piece, "Shifting part of a piece past the edge doesn't move any of it.");
+
+        static geom test_orientations[PIECE_ORIENTATIONS_LIMIT];
+        uint test_orientation_count = populate_orientations(test_orientations, test_piece, false);
+        assertTrue(test_orientation_count == 36, "36 unique orientations should have been found (12 rotations, 3 places each).");
+
+        assertGeomIn(test_piece, test_orientations, test_orientation_count, "The original piece should be included as one of the orientations.");
+        assertGeomIn(l2b(0, 0, 0) | l2b(1, 0, 2) | l2b(2, 0, 2) | l2b(0, 0, 1) | l2b(0, 0, 2), test_orientations, test_orientation_count, "A single rotation around y should be included as one of the orientations.");
+        assertGeomIn(l2b(0, 1, 0) | l2b(1, 1, 2) | l2b(2, 1, 2) | l2b(0, 1, 1) | l2b(0, 1, 2), test_orientations, test_orientation_count, "A single rotation around y plus a shift in positive y should be included as one of the orientations.");
+        assertGeomIn(l2b(0, 0, 0) | l2b(0, 1, 0) | l2b(0, 2, 0) | l2b(1, 0, 0) | l2b(2, 0, 0), test_orientations, test_orientation_count, "A rotation that's not around a single axis should be included as one of the orientations.");
+        assertTrue(populate_orientations(test_orientations, test_piece, true) == 36, "A flat piece is its own mirror image.");
+
+        geom twisted = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(1, 1, 0) | l2b(1, 1, 1);
+        geom twisted_mirror = l2b(0, 0, 1) | l2b(1, 0, 1) | l2b(1, 1, 1) | l2b(1, 1, 0);
+        uint twisted_count = populate_orientations(test_orientations, twisted, false);
+        assertFalse(piece_in_array(test_orientations, twisted_count, twisted_mirror), "A twisted piece can't be turned into its mirror image.");
+        assertTrue(populate_orientations(test_orientations, twisted, true) == 2 * twisted_count, "Mirror images double the orientations of a twisted piece.");
+        assertTrue(piece_in_array(test_orientations, 2 * twisted_count, twisted_mirror), "The mirror image should be included with mirrors.");
+
+        set_space(2, 3, 4);
+        assertTrue(populate_orientations(test_orientations, l2b(0, 0, 0) | l2b(0, 0, 1) | l2b(0, 0, 2), false) == 20,
+            "A row of three fits 8 ways along y and 12 along z in a 2 x 3 x 4 space (and not along x).");
+
+        set_space(test_size, test_size, test_size);
+
+        #ifdef CHECK_HOLE_SIZES
+        // Both flood fills should agree on spaces with holes of all shapes and sizes:
+        uint64_t random_state = 88172645463325252ull;
+        for (uint i=0; i<2000; ++i){
+            geom random_space = GEOM_EMPTY;
+            for (uint part=0; part<space_size; ++part){
+                random_state ^= random_state << 13;
+                random_state ^= random_state >> 7;
+                random_state ^= random_state << 17;
+                if (random_state % 8 < 2 + i % 6){ // Filling between 2/8 and 7/8 of the space
+                    random_space |= geom_bit(part);
+                }
+            }
+            uint dfs_regions, bitwise_regions;
+            if (are_empty_spaces_factors_dfs(random_space, &dfs_regions) != are_empty_spaces_factors_bitwise(random_space, &bitwise_regions)
+                    || dfs_regions != bitwise_regions){
+                printf("\nfailed: flood fills disagree on space:\n");
+                print_space(random_space);
+                ++failures;
+                break;
+            }
+        }
+        uint regions;
+        assertTrue(are_empty_spaces_factors_bitwise(full_space_mask, &regions) && regions == 0, "A full space has no holes.");
+        assertTrue(are_empty_spaces_factors_bitwise(GEOM_EMPTY, &regions) == (space_size % common_piece_size == 0), "An empty space is one big hole.");
+        assertFalse(are_empty_spaces_factors_bitwise(full_space_mask & ~l2b(0, 0, 0), &regions), "A single hole is not a factor.");
+
+        // Pieces of 4, 5 and 5 spots can fill 0, 4, 5, 9, 10 or 14 spots between them:
+        num_pieces = 3;
+        piece_sizes[0] = 4;
+        piece_sizes[1] = 5;
+        piece_sizes[2] = 5;
+        uint sums_counts[3] = {1, 1, 1};
+        geom sums = subset_sums(sums_counts);
+        assertTrue(geom_overlaps(sums, geom_bit(9)), "4 + 5 is a sum of the pieces.");
+        assertFalse(geom_overlaps(sums, geom_bit(8)), "8 isn't a sum of the pieces: only one is 4 spots.");
+        assertFalse(geom_overlaps(sums, geom_bit(15)), "The pieces only add up to 14.");
+        sums_counts[0] = 0;
+        assertFalse(geom_overlaps(subset_sums(sums_counts), geom_bit(9)), "Pieces with no orientations left don't count.");
+        geom first_spots[16] = {GEOM_EMPTY}; // The lowest n spots, which are all connected
+        for (uint n=1; n<16; ++n){
+            first_spots[n] = first_spots[n-1] | geom_bit(n-1);
+        }
+        assertTrue(are_empty_spaces_sums(full_space_mask & ~first_spots[9], sums, &regions) && regions == 1, "A hole of 9 can be filled.");
+        assertFalse(are_empty_spaces_sums(full_space_mask & ~first_spots[8], sums, &regions), "A hole of 8 can't be filled.");
+        assertTrue(are_empty_spaces_sums(full_space_mask & ~first_spots[14], sums, &regions),
+            "A hole as big as all the pieces together can be filled.");
+        assertFalse(are_empty_spaces_sums(full_space_mask & ~first_spots[15], sums, &regions), "A hole of 15 is too big.");
+        assertTrue(are_empty_spaces_sums(full_space_mask, sums, &regions) && regions == 0, "A full space has no holes to fill.");
+        num_pieces = 0;
+        #endif
 
-            assertGeomEqual(rotate_piece(l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 0, 1) | l2b(0, 0, 2), X_AXIS, 1),
-                l2b(0, 0, 2) | l2b(1, 0, 2) | l2b(2, 0, 2) | l2b(0, 1, 2) | l2b(0, 2, 2), "Rotate by one x.");
+        // Every filter kernel should keep the same orientations, in the same order:
+        struct filter_kernel_option kernels[3];
+        uint kernel_count = available_filter_kernels(kernels);
+        geom filter_input[37];
+        geom filter_expected[37];
+        geom filter_output[37];
+        geom filter_scratch[37];
+        for (uint i=0; i<37; ++i){
+            filter_input[i] = l2b(i % space_width, (i / space_width) % space_height, 0) | l2b(0, 0, i % space_depth);
+        }
+        geom filter_space = l2b(1 % space_width, 0, 0) | l2b(0, 0, space_depth - 1);
+        geom expected_fill = l2b(0, 0, 0);
+        uint expected_count = filter_orientations_plain(memcpy(filter_expected, filter_input, sizeof(filter_input)), 37, filter_space,
+            &expected_fill, filter_scratch);
+        for (uint k=1; k<kernel_count; ++k){
+            for (uint count=0; count<=37; count+=37-count < 5 ? 1 : 5){ // Lengths with every remainder
+                geom fill = l2b(0, 0, 0);
+                geom count_fill = l2b(0, 0, 0);
+                memcpy(filter_output, filter_input, sizeof(filter_input));
+                memcpy(filter_expected, filter_input, sizeof(filter_input));
+                uint kept = kernels[k].kernel(filter_output, count, filter_space, &fill, filter_scratch);
+                uint expected_kept = filter_orientations_plain(filter_expected, count, filter_space, &count_fill, filter_scratch);
+                if (kept != expected_kept || !geom_equal(fill, count_fill)
+                        || memcmp(filter_output, filter_expected, sizeof(filter_input)) != 0){
+                    printf("\nfailed: the %s filter kernel disagrees with the plain one on %u orientations", kernels[k].name, count);
+                    ++failures;
+                }
+            }
+        }
+        assertTrue(expected_count > 0 && expected_count < 37, "The filter kernel test should keep some orientations and drop others.");
+        assertFalse(geom_overlaps(expected_fill, filter_space), "Only orientations that fit count towards the fill.");
+
+        // Reading a puzzle with copies of a piece:
+        char puzzle_text[] = "# A comment\nbox 3 2 1\npiece 0,0,0 1,0,0 x2 #ff0000 \"Two in a row\"\n\npiece 2,0,0 2,1,0\n";
+        FILE *puzzle_file = fmemopen(puzzle_text, strlen(puzzle_text), "r");
+        static struct puzzle test_puzzle;
+        assertTrue(read_puzzle(puzzle_file, "test", &test_puzzle), "The test puzzle should be read.");
+        fclose(puzzle_file);
+        assertTrue(test_puzzle.piece_count == 3, "Each copy of a piece counts as a piece.");
+        assertTrue(test_puzzle.groups[0] == 0 && test_puzzle.groups[1] == 0 && test_puzzle.groups[2] == 2, "Copies share a group.");
+        assertGeomEqual(test_puzzle.pieces[1], geom_from_uint64(0b101), "Spots are numbered like l2b() does for the puzzle's box.");
+        assertGeomEqual(test_puzzle.pieces[2], geom_from_uint64(0b110000), "Spots are numbered like l2b() does for the puzzle's box.");
+        assertTrue(strcmp(test_puzzle.names[1], "Two in a row") == 0, "Quoted names.");
+    }
 
-            assertGeomEqual(rotate_piece(l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 0, 1) | l2b(0, 0, 2), X_AXIS, 2),
-                l2b(0, 2, 0) | l2b(1, 2, 2) | l2b(2, 2, 2) | l2b(0, 2, 1) | l2b(0, 2, 2), "Rotate by two x.");
+    return failures;
+}
 
 
-            // Testing populate_orientations:
-            geom test_piece = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 0, 1) | l2b(0, 0, 2);
+/*
+Statistics about the shape of the search tree, for tuning the pruning and the choice of
+what to branch on (see --stats). Both engines keep them as they go, and the threads of a
+parallel search add theirs up. They're only ever incremented, so they're cheap enough to
+always keep.
+*/
 
-            geom test_orientations[PIECE_ORIENTATIONS_LIMIT] = {0};
-            assertTrue(populate_orientations(test_orientations, test_piece) == 24, "24 unique orientations should have been found.");
+#define PRUNE_NO_ORIENTATIONS 0 // Some remaining piece doesn't fit anywhere
+#define PRUNE_UNFILLABLE_SPOT 1 // Some empty spot can't be filled by any remaining piece
+#define PRUNE_HOLE_SIZES 2 // Some hole isn't a multiple of the pieces' size (see are_empty_spaces_factors())
+#define PRUNE_NOTHING_FITS_SPOT 3 // Nothing fits the lowest empty spot (branching on spots)
+#define PRUNE_TRANSPOSITION 4 // The transposition table knows there's nothing under this node
+#define PRUNE_DEAD_POCKET 5 // Some small walled off pocket can't be filled by the pieces left (see search_has_dead_pocket())
+#define PRUNE_DEAD_REGIONS 6 // The holes split up and the pieces left can't fill all but the biggest (see search_has_dead_regions())
+#define PRUNE_REASONS 7
+
+const char *prune_reason_names[PRUNE_REASONS] = {"no_orientations_left", "unfillable_spot", "hole_sizes", "nothing_fits_spot",
+    "transposition", "dead_pocket", "dead_regions"};
+
+#define POCKET_MAX_SPOTS 15 // The biggest pockets search_has_dead_pocket() tries to fill
+#define REGIONS_MAX_SPOTS 20 // The most spots search_has_dead_regions() tries to fill, in all the regions but the biggest
+
+#define BRANCHING_BUCKETS 16 // Nodes with 1, 2-3, 4-7, ... candidates
+
+struct search_stats {
+    long unsigned int placements_at_depth[MAX_PIECES]; // Pieces placed with that many already in
+    long unsigned int prunes[PRUNE_REASONS]; // Nodes backed out of, by why
+    long unsigned int branching[BRANCHING_BUCKETS]; // Nodes by how many candidates they had to try
+
+    // The transposition table's (the hits are prunes[PRUNE_TRANSPOSITION]):
+    long unsigned int transposition_lookups;
+    long unsigned int transposition_stores;
+    long unsigned int transposition_replacements; // Stores that pushed out another node
+
+    // Nodes with only one thing to place: a piece with one orientation left, or the only
+    // orientation that can fill some spot (see search_force_spot()):
+    long unsigned int forced_pieces;
+    long unsigned int forced_spots;
+
+    long unsigned int dead_pockets[POCKET_MAX_SPOTS + 1]; // prunes[PRUNE_DEAD_POCKET] by how many spots the pocket had
+    long unsigned int split_nodes; // Nodes where the holes were in more than one region (see search_has_dead_regions())
+    long unsigned int fill_nodes; // Placements tried filling pockets and regions (see search_fill_pocket())
+    long unsigned int backjumps[MAX_PIECES]; // Times backing out jumped back past that many placements (see search_next())
+};
 
-            assertGeomIn(test_piece, test_orientations, PIECE_ORIENTATIONS_LIMIT, "The original piece should be included as one of the orientations.");
-            assertGeomIn(l2b(0, 0, 0) | l2b(1, 0, 2) | l2b(2, 0, 2) | l2b(0, 0, 1) | l2b(0, 0, 2), test_orientations, PIECE_ORIENTATIONS_LIMIT, "A single rotation around y should be included as one of the orientations.");
-            assertGeomIn(l2b(0, 1, 0) | l2b(1, 1, 2) | l2b(2, 1, 2) | l2b(0, 1, 1) | l2b(0, 1, 2), test_orientations, PIECE_ORIENTATIONS_LIMIT, "A single rotation around y plus a shift in positive y should be included as one of the orientations.");
+static inline void count_branching(struct search_stats *stats, uint candidate_count){
+    // Only for nodes with some candidates: the others are prunes.
+    uint bucket = 31 - (uint)__builtin_clz(candidate_count);
+    ++stats->branching[bucket < BRANCHING_BUCKETS ? bucket : BRANCHING_BUCKETS - 1];
+}
 
-        }
+void search_stats_add(struct search_stats *to, const struct search_stats *from){
+    for (uint i=0; i<MAX_PIECES; ++i){
+        to->placements_at_depth[i] += from->placements_at_depth[i];
+    }
+    for (uint i=0; i<PRUNE_REASONS; ++i){
+        to->prunes[i] += from->prunes[i];
+    }
+    for (uint i=0; i<BRANCHING_BUCKETS; ++i){
+        to->branching[i] += from->branching[i];
+    }
+    to->transposition_lookups += from->transposition_lookups;
+    to->transposition_stores += from->transposition_stores;
+    to->transposition_replacements += from->transposition_replacements;
+    to->forced_pieces += from->forced_pieces;
+    to->forced_spots += from->forced_spots;
+    to->split_nodes += from->split_nodes;
+    to->fill_nodes += from->fill_nodes;
+    for (uint i=0; i<MAX_PIECES; ++i){
+        to->backjumps[i] += from->backjumps[i];
+    }
+    for (uint i=0; i<=POCKET_MAX_SPOTS; ++i){
+        to->dead_pockets[i] += from->dead_pockets[i];
     }
-
-    return failures;
 }
 
 
-int main(){
-    struct sigaction action;
-    action.sa_handler = sig_handler;
-    sigemptyset(&action.sa_mask);
-    sigaction(SIGINT, &action, NULL);
-    sigaction(SIGUSR1, &action, NULL);
+/*
+Alternative search engine: the puzzle as an exact cover problem, solved with Knuth's
+Algorithm X using dancing links (https://arxiv.org/abs/cs/0011047).
 
-    printf("\nRunning tests...\n");
-    uint failures = test();
-    if (failures == 0){
-        printf("passed!\n");
-    } else {
-        printf("\nThere were %u test failures. Exiting.\n", failures);
-        return 1;
-    }
+There's a column for each piece (every piece gets placed exactly once) and a column for
+each spot in the space (every spot gets filled exactly once, or at most once if the
+space isn't going to be full). Each orientation of each piece is a row covering the
+piece's column and the columns of the spots it fills.
 
+Where the main loop always branches on the piece with the fewest orientations left,
+this branches on whichever column has the fewest rows left, be it a piece or a spot.
+*/
 
+struct dlx {
+    uint num_pieces;
+
+    // Links for each node. Nodes 1 through column_count are the column headers and node 0 is
+    // the root, linking together the columns that still need to be covered.
+    uint *left;
+    uint *right;
+    uint *up;
+    uint *down;
+    uint *column;
+    uint *row; // Which row (piece orientation) each node belongs to.
+    uint *size; // How many rows are left in each column.
+    uint column_count;
+
+    uint *row_piece;
+    geom *row_geom;
+
+    uint *choice; // The node of the row we picked at each level.
+    uint level;
+    bool found_solution;
+
+    long unsigned int loop_counter;
+    struct search_stats stats; // placements_at_depth counts the rows picked at each level
+    bool show_progress; // Print the loop rate
+    clock_t previous; // When we last printed progress
+};
 
-    printf("\nStarting...\n");
-
-    // Problem 1:
-    // Space: 5 x 3 x 2
-    // #define NUM_PIECES 6
-    // geom piece1 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(3, 0, 0) | l2b(4, 0, 0);
-    // geom piece2 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0);
-    // geom piece3 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0);
-    // geom piece4 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0);
-    // geom piece5 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0);
-    // geom piece6 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0);
-
-
-
-    // Problem 4:
-    // Space: 3 x 3 x 3
-    // #define NUM_PIECES 6
-    // geom piece1 = l2b(0, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0) | l2b(2, 1, 0);
-    // geom piece2 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(1, 1, 0) | l2b(2, 0, 0);
-    // geom piece3 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(1, 1, 0) | l2b(2, 0, 1);
-    // geom piece4 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(0, 1, 0) | l2b(0, 1, 1);
-    // geom piece5 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(1, 1, 0) | l2b(1, 1, 1);
-    // geom piece6 = l2b(0, 0, 0) | l2b(0, 1, 0) | l2b(0, 1, 1) | l2b(1, 1, 0) | l2b(1, 2, 0);
-
-
-
-    // Problem 5:
-    // Space: 3 x 3 x 3
-    // #define NUM_PIECES 6
-    // geom piece1 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(1, 1, 0);
-    // geom piece2 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0);
-    // geom piece3 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0);
-    // geom piece4 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(2, 1, 0);
-    // geom piece5 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0) | l2b(2, 1, 0);
-    // geom piece6 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0) | l2b(2, 1, 0);
-
-
-    // geom piece1 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0);
-    // geom piece2 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0);
-    // geom piece3 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0);
-    // geom piece4 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0) | l2b(2, 1, 0);
-    // geom piece5 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0) | l2b(2, 1, 0);
-    // geom piece6 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 1, 0) | l2b(2, 1, 0);
-
-
-    // Coding Challenge:
-    // Space: 3 x 3 x 3
-    // #define NUM_PIECES 7
-    // geom piece1 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(1, 1, 0);
-    // geom piece2 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(2, 1, 0);
-    // geom piece3 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(1, 1, 0);
-    // geom piece4 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(1, 1, 0) | l2b(2, 1, 0);
-    // geom piece5 = l2b(0, 0, 1) | l2b(1, 0, 1) | l2b(1, 1, 1) | l2b(1, 0, 0);
-    // geom piece6 = l2b(0, 0, 1) | l2b(1, 0, 1) | l2b(0, 1, 1) | l2b(1, 0, 0);
-    // geom piece7 = l2b(0, 0, 1) | l2b(1, 0, 1) | l2b(1, 0, 0) | l2b(1, 1, 0);
-
-    // geom pieces[NUM_PIECES] = {piece1, piece2, piece3, piece4, piece5, piece6, piece7};
-    // char *piece_colors[NUM_PIECES] = {
-    //     "\e[38;2;255;0;0m",     // Red
-    //     "\e[38;2;0;128;128m",   // Teal
-    //     "\e[38;2;0;100;0m",     // Dark Green
-    //     "\e[38;2;154;255;154m", // Light Green
-    //     "\e[38;2;255;180;0m",   // Light Orange
-    //     "\e[38;2;0;20;205m",    // Blue
-    //     "\e[38;2;170;255;154m", // Light Green
-    // };
-
-    // #ifdef DEBUG_SOLUTION
-    // geom solution[NUM_PIECES] = {
-    //     l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(1, 1, 0),
-    //     l2b(0, 2, 2) | l2b(1, 2, 2) | l2b(2, 1, 2) | l2b(2, 2, 2),
-    //     l2b(2, 0, 0) | l2b(2, 0, 1) | l2b(2, 0, 2) | l2b(2, 1, 1),
-    //     l2b(0, 0, 1) | l2b(0, 0, 2) | l2b(0, 1, 0) | l2b(0, 1, 1),
-    //     l2b(1, 2, 0) | l2b(2, 1, 0) | l2b(2, 2, 0) | l2b(2, 2, 1),
-    //     l2b(0, 2, 0) | l2b(0, 2, 1) | l2b(1, 1, 1) | l2b(1, 2, 1),
-    //     l2b(0, 1, 2) | l2b(1, 0, 1) | l2b(1, 0, 2) | l2b(1, 1, 2),
-    // };
-    // #endif
-
-    // Small physical wooden puzzle:
-    // Space: 3 x 3 x 3
-    // #define NUM_PIECES 6
-    // geom piece1 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0);
-    // geom piece2 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(0, 1, 0) | l2b(1, 0, 1);
-    // geom piece3 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(1, 0, 1);
-    // geom piece4 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(1, 1, 0) | l2b(1, 0, 1) | l2b(2, 0, 1);
-    // geom piece5 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(1, 0, 1) | l2b(1, 1, 1);
-    // geom piece6 = l2b(0, 0, 0) | l2b(1, 0, 0) | l2b(2, 0, 0) | l2b(1, 0, 1) | l2b(1, 1, 1);
-
-    // geom pieces[NUM_PIECES] = {piece1, piece2, piece3, piece4, piece5, piece6};
-
-
-
-    // Real problem:
-    // Space: 5 x 5 x 5
-    #define NUM_PIECES 25
-    geom piece1  = l2b(0,0,0) | l2b(0,0,1) | l2b(0,0,2) | l2b(0,0,3) | l2b(0,0,4); // color=[255, 180, 0]), # Light Orange "Chocolate Bar"
-    geom piece2  = l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,1,0) | l2b(3,1,0); // color=[238, 238, 0]), # Yellow
-    geom piece3  = l2b(0,0,0) | l2b(1,0,0) | l2b(0,1,0) | l2b(0,2,0) | l2b(1,2,0); // color=[245, 238, 0]), # Yellow "U"
-    geom piece4  = l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(0,1,0) | l2b(0,2,0); // color=[255, 165, 0]), # Light Orange "Symetric L"
-    geom piece5  = l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(1,0,1) | l2b(2,0,1); // color=[238, 154, 0]), # Dark Orange "Y-ish"
-    geom piece6  = l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,1,0) | l2b(2,1,1); // color=[238, 145, 0]), # Dark Orange "L with hook off short end"
-    geom piece7  = l2b(0,0,0) | l2b(0,0,1) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,1,0); // color=[238, 154, 0]), # Dark Orange "L with hook off long end"
-    geom piece8  = l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(1,1,0) | l2b(1,2,0); // color=[255, 0, 0]), # Red "T"
-    geom piece9  = l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(2,1,0) | l2b(2,2,0); // color=[255, 0, 20]), # Red "W"
-    geom piece10 = l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,1,0) | l2b(2,0,1); // color=[200, 0, 0]), # Dark Red "L" with hook off corner"
-    geom piece11 = l2b(0,0,0) | l2b(0,1,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(2,0,1); // color=[200, 20, 0]), # Dark Red "L with hook off long end"
-    geom piece12 = l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(3,0,0) | l2b(3,1,0); // color=[142, 56, 142]), # Purple "L"
-    geom piece13 = l2b(0,1,0) | l2b(1,1,0) | l2b(2,1,0) | l2b(1,0,0) | l2b(1,2,0); // color=[142, 40, 142]), # Purple "Cross"
-    geom piece14 = l2b(0,0,0) | l2b(0,0,1) | l2b(1,0,0) | l2b(1,1,0) | l2b(1,1,1); // color=[0, 0, 205]), # Blue "Two towers"
-    geom piece15 = l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(1,1,0) | l2b(2,0,1); // color=[0, 20, 205]), # Blue "L with hook off middle of long end"
-    geom piece16 = l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(2,0,0) | l2b(2,1,0); // color=[0, 128, 128]), # Teal "Foam finger"
-    geom piece17 = l2b(0,0,0) | l2b(0,1,0) | l2b(1,1,0) | l2b(2,1,0) | l2b(2,2,0); // color=[20, 128, 128]), # Teal "Z"
-    geom piece18 = l2b(0,0,0) | l2b(1,0,0) | l2b(1,0,1) | l2b(2,0,1) | l2b(2,1,1); // color=[173, 255, 47]), # Yellow-Green "Left-handed"
-    geom piece19 = l2b(0,0,0) | l2b(0,0,1) | l2b(1,0,0) | l2b(1,1,0) | l2b(2,1,0); // color=[173, 234, 47]), # Yellow-Green "Right-handed"
-    geom piece20 = l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(1,0,1) | l2b(2,0,0); // color=[154, 255, 154]), # Light Green "Bent Cross"
-    geom piece21 = l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(1,0,1) | l2b(2,1,0); // color=[170, 255, 154]), # Light Green "L with hook off middle of long end"
-    geom piece22 = l2b(0,0,0) | l2b(1,0,0) | l2b(2,0,0) | l2b(3,0,0) | l2b(2,1,0); // color=[162, 205, 90]), # Olive Green "Rifle"
-    geom piece23 = l2b(0,0,0) | l2b(1,0,0) | l2b(1,1,0) | l2b(1,2,0) | l2b(2,1,0); // color=[150, 205, 90]), # Olive Green "Y-ish"
-    geom piece24 = l2b(0,0,0) | l2b(1,0,0) | l2b(0,1,0) | l2b(1,1,0) | l2b(1,1,1); // color=[0, 100, 0]), # Dark Green "Base and tower"
-    geom piece25 = l2b(0,0,0) | l2b(1,0,0) | l2b(1,0,1) | l2b(1,1,0) | l2b(2,1,0); // color=[20, 100, 0]), # Dark Green "Y-ish"
-
-    geom pieces[NUM_PIECES] = {
-        piece1,
-        piece2,
-        piece3,
-        piece4,
-        piece5,
-        piece6,
-        piece7,
-        piece8,
-        piece9,
-        piece10,
-        piece11,
-        piece12,
-        piece13,
-        piece14,
-        piece15,
-        piece16,
-        piece17,
-        piece18,
-        piece19,
-        piece20,
-        piece21,
-        piece22,
-        piece23,
-        piece24,
-        piece25,
-    };
+void dlx_append_node(struct dlx *d, uint node, uint first, uint c, uint row){
+    /*
+    Adds node to the bottom of column c and to the end of the row starting at node first.
+    */
+    d->column[node] = c;
+    d->row[node] = row;
+    d->up[node] = d->up[c];
+    d->down[node] = c;
+    d->down[d->up[c]] = node;
+    d->up[c] = node;
+    ++d->size[c];
+
+    d->left[node] = d->left[first];
+    d->right[node] = first;
+    d->right[d->left[first]] = node;
+    d->left[first] = node;
+}
 
-    //
-    char *piece_colors[NUM_PIECES] = {
-        "\e[38;2;255;180;0m",   // piece1: Light Orange "Chocolate Bar"
-        "\e[38;2;238;238;0m",   // piece2: Yellow
-        "\e[38;2;245;238;0m",   // piece3: Yellow "U"
-        "\e[38;2;255;165;0m",   // piece4: Light Orange "Symetric L"
-        "\e[38;2;238;154;0m",   // piece5: Dark Orange "Y-ish"
-        "\e[38;2;238;145;0m",   // piece6: Dark Orange "L with hook off short end"
-        "\e[38;2;238;154;0m",   // piece7: Dark Orange "L with hook off long end"
-        "\e[38;2;255;0;0m",     // piece8: Red "T"
-        "\e[38;2;255;0;20m",    // piece9: Red "W"
-        "\e[38;2;200;0;0m",     // piece10: Dark Red "L" with hook off corner"
-        "\e[38;2;200;20;0m",    // piece11: Dark Red "L with hook off long end"
-        "\e[38;2;142;56;142m",  // piece12: Purple "L"
-        "\e[38;2;142;40;142m",  // piece13: Purple "Cross"
-        "\e[38;2;0;0;205m",     // piece14: Blue "Two towers"
-        "\e[38;2;0;20;205m",    // piece15: Blue "L with hook off middle of long end"
-        "\e[38;2;0;128;128m",   // piece16: Teal "Foam finger"
-        "\e[38;2;20;128;128m",  // piece17: Teal "Z"
-        "\e[38;2;173;255;47m",  // piece18: Yellow-Green "Left-handed"
-        "\e[38;2;173;234;47m",  // piece19: Yellow-Green "Right-handed"
-        "\e[38;2;154;255;154m", // piece20: Light Green "Bent Cross"
-        "\e[38;2;170;255;154m", // piece21: Light Green "L with hook off middle of long end"
-        "\e[38;2;162;205;90m",  // piece22: Olive Green "Rifle"
-        "\e[38;2;150;205;90m",  // piece23: Olive Green "Y-ish"
-        "\e[38;2;0;100;0m",     // piece24: Dark Green "Base and tower"
-        "\e[38;2;20;100;0m",    // piece25: Dark Green "Y-ish"
-    };
+void dlx_init(struct dlx *d, geom **orientations, uint *orientation_counts){
+    uint row_count = 0;
+    uint node_count = 1 + num_pieces + space_size;
+    for (uint i=0; i<num_pieces; ++i){
+        row_count += orientation_counts[i];
+        for (uint j=0; j<orientation_counts[i]; ++j){
+            node_count += 1 + geom_popcount(orientations[i][j]);
+        }
+    }
 
-    void print_colored_pieces_in_space(
-        geom orientations_history[NUM_PIECES][NUM_PIECES][PIECE_ORIENTATIONS_LIMIT],
-        uint orientation_history[NUM_PIECES],
-        uint piece_placing_history[NUM_PIECES],
-        uint to_piece){
+    d->num_pieces = num_pieces;
+    d->column_count = num_pieces + space_size;
+    d->left = malloc(node_count * sizeof(uint));
+    d->right = malloc(node_count * sizeof(uint));
+    d->up = malloc(node_count * sizeof(uint));
+    d->down = malloc(node_count * sizeof(uint));
+    d->column = malloc(node_count * sizeof(uint));
+    d->row = malloc(node_count * sizeof(uint));
+    d->size = calloc(d->column_count + 1, sizeof(uint));
+    d->row_piece = malloc(row_count * sizeof(uint));
+    d->row_geom = malloc(row_count * sizeof(geom));
+    d->choice = calloc(num_pieces + 1, sizeof(uint));
+    d->level = 0;
+    d->found_solution = false;
+    d->loop_counter = 0;
+    memset(&d->stats, 0, sizeof(d->stats));
+    d->show_progress = true;
+    d->previous = clock();
+
+    // Column headers. Piece columns first, then one column per spot: bit n of a geom is column num_pieces + 1 + n.
+    d->left[0] = 0;
+    d->right[0] = 0;
+    for (uint c=1; c<=d->column_count; ++c){
+        d->up[c] = c;
+        d->down[c] = c;
+        d->column[c] = c;
+        if (!space_will_be_full && c > num_pieces){
+            // Spots don't have to be filled, so they're not linked in to the columns to cover.
+            d->left[c] = c;
+            d->right[c] = c;
+            continue;
+        }
+        d->left[c] = d->left[0];
+        d->right[c] = 0;
+        d->right[d->left[0]] = c;
+        d->left[0] = c;
+    }
 
-        for (uint z=0; z<SPACE_DEPTH; ++z){
-            printf(" ┌");
-            for (uint x=0; x<SPACE_WIDTH; ++x){
-                printf("───");
+    uint node = d->column_count + 1;
+    uint row = 0;
+    for (uint i=0; i<num_pieces; ++i){
+        for (uint j=0; j<orientation_counts[i]; ++j){
+            geom orientation = orientations[i][j];
+            d->row_piece[row] = i;
+            d->row_geom[row] = orientation;
+
+            uint first = node;
+            d->left[first] = first;
+            d->right[first] = first;
+            dlx_append_node(d, node++, first, i + 1, row);
+            for (uint n=0; n<space_size; ++n){
+                if (geom_overlaps(orientation, geom_bit(n))){
+                    dlx_append_node(d, node++, first, num_pieces + 1 + n, row);
+                }
             }
-            printf("┐ ");
+            ++row;
         }
-        printf("\n");
+    }
+}
 
+void dlx_free(struct dlx *d){
+    free(d->left);
+    free(d->right);
+    free(d->up);
+    free(d->down);
+    free(d->column);
+    free(d->row);
+    free(d->size);
+    free(d->row_piece);
+    free(d->row_geom);
+    free(d->choice);
+}
 
-        for (uint z=0; z<SPACE_DEPTH; ++z){
-            for (uint y=0; y<SPACE_HEIGHT; ++y){
-                printf(" │");
-                for (uint x=0; x<SPACE_WIDTH; ++x){
-                    bool found_match = false;
-                    uint matching_piece = 0;
+void dlx_cover(struct dlx *d, uint c){
+    d->right[d->left[c]] = d->right[c];
+    d->left[d->right[c]] = d->left[c];
+    for (uint i=d->down[c]; i!=c; i=d->down[i]){
+        for (uint j=d->right[i]; j!=i; j=d->right[j]){
+            d->down[d->up[j]] = d->down[j];
+            d->up[d->down[j]] = d->up[j];
+            --d->size[d->column[j]];
+        }
+    }
+}
 
-                    for (uint i=0; i<to_piece; ++i){
-                        uint piece_index = piece_placing_history[i];
-                        if (orientations_history[i][piece_index][orientation_history[i]] & l2b(x, y, z)){
-                            matching_piece = i;
-                            found_match = true;
-                            break;
-                        }
-                    }
-                    if (found_match){
-                        printf(piece_colors[piece_placing_history[matching_piece]]);
-                        #if NUM_PIECES > 10
-                        printf(" ■ "); // Not printing the piece number when it could be more than 1 digit
-                        #else
-                        printf(" %u ", piece_placing_history[matching_piece]+1);
-                        #endif
-                        printf(RESET);
-                    } else{
-                        printf("   ");
+void dlx_uncover(struct dlx *d, uint c){
+    for (uint i=d->up[c]; i!=c; i=d->up[i]){
+        for (uint j=d->left[i]; j!=i; j=d->left[j]){
+            ++d->size[d->column[j]];
+            d->down[d->up[j]] = j;
+            d->up[d->down[j]] = j;
+        }
+    }
+    d->right[d->left[c]] = c;
+    d->left[d->right[c]] = c;
+}
+
+bool dlx_next_solution(struct dlx *d){
+    /*
+    Searches until the next solution is found, returning true, or until there are no
+    more solutions (or we're interupted), returning false. The rows of a solution are
+    d->choice[0] through d->choice[d->level-1].
+
+    Call again to resume looking for more solutions.
+    */
+    bool backout = d->found_solution;
+    d->found_solution = false;
+
+    while (keep_running){
+        ++d->loop_counter;
+        if (d->show_progress && d->loop_counter % 1000000 == 0){
+            clock_t now = clock();
+            double duration = ((double) (now - d->previous)) / CLOCKS_PER_SEC;
+            d->previous = now;
+            printf("%.1f seconds at a rate of %.2f million loops/second.\n", duration, 1.0/duration);
+        }
+
+        if (backout){
+            backout = false;
+            // Taking out the row placed last and trying the next one in the same column.
+            // If that column has run out of rows, we keep backing up.
+            while (true){
+                if (d->level == 0){
+                    return false;
+                }
+                --d->level;
+                uint node = d->choice[d->level];
+                uint c = d->column[node];
+                for (uint j=d->left[node]; j!=node; j=d->left[j]){
+                    dlx_uncover(d, d->column[j]);
+                }
+                node = d->down[node];
+                if (node != c){
+                    d->choice[d->level] = node;
+                    for (uint j=d->right[node]; j!=node; j=d->right[j]){
+                        dlx_cover(d, d->column[j]);
                     }
+                    ++d->stats.placements_at_depth[d->level];
+                    ++d->level;
+                    break;
                 }
-                printf("│ ");
+                dlx_uncover(d, c);
             }
-            printf("\n");
-        }
-        for (uint z=0; z<SPACE_DEPTH; ++z){
-            printf(" └");
-            for (uint x=0; x<SPACE_WIDTH; ++x){
-                printf("───");
+        } else {
+            if (d->right[0] == 0){ // Every column is covered
+                d->found_solution = true;
+                return true;
             }
-            printf("┘ ");
-        }
-        printf("\n");
-    }
 
-    printf("Pieces defined!\n");
+            // Picking the column with the fewest rows left:
+            uint c = d->right[0];
+            uint smallest_size = d->size[c];
+            for (uint j=d->right[c]; j!=0 && smallest_size>0; j=d->right[j]){
+                if (d->size[j] < smallest_size){
+                    smallest_size = d->size[j];
+                    c = j;
+                }
+            }
+            if (smallest_size == 0){ // Some piece or spot can't be covered anymore
+                ++d->stats.prunes[c <= d->num_pieces ? PRUNE_NO_ORIENTATIONS : PRUNE_UNFILLABLE_SPOT];
+                backout = true;
+                continue;
+            }
+            count_branching(&d->stats, smallest_size);
 
-    geom space = 0;
-    geom full_space = 0;
-    // Initialize full_space. There's got to be a better way of doing this but whatever:
-    for (uint x=0; x<SPACE_WIDTH; ++x){
-        for (uint y=0; y<SPACE_HEIGHT; ++y){
-            for (uint z=0; z<SPACE_DEPTH; ++z){
-                full_space |= l2b(x, y, z);
+            dlx_cover(d, c);
+            uint node = d->down[c];
+            d->choice[d->level] = node;
+            for (uint j=d->right[node]; j!=node; j=d->right[j]){
+                dlx_cover(d, d->column[j]);
             }
+            ++d->stats.placements_at_depth[d->level];
+            ++d->level;
         }
     }
+    return false;
+}
 
-    printf("full_space:\n");
-    print_space(full_space);
-
-    geom orientations[NUM_PIECES][PIECE_ORIENTATIONS_LIMIT] = {{0}};
-    uint orientation_counts[NUM_PIECES] = {0};
-    double total_permutations = 1;
-    #ifdef TRACK_PROGRESS
-    double permutations_tried = 0;
-    #endif
-    long unsigned int loop_counter = 0;
-    long unsigned int previous_loop_counter = 0;
-
-    clock_t start = clock();
-    clock_t previous = start;
-    clock_t end;
-    double duration;
-
-    for (uint i=0; i<NUM_PIECES; i++){
-        orientation_counts[i] = populate_orientations(orientations[i], pieces[i]);
-        printf("Found %u unique orientations for piece %u.\n", orientation_counts[i], i+1);
-        total_permutations *= orientation_counts[i];
+void dlx_get_solution(struct dlx *d, geom *placed_pieces, uint *piece_placing_history){
+    for (uint i=0; i<d->level; ++i){
+        uint row = d->row[d->choice[i]];
+        placed_pieces[i] = d->row_geom[row];
+        piece_placing_history[i] = d->row_piece[row];
     }
+}
 
-    printf("Total permutations: %e\n", total_permutations);
 
+void print_colored_pieces_in_space(
+    geom *placed_pieces, // The orientation each piece was placed with, in placing order
+    uint *piece_placing_history, // Which piece was placed, in placing order
+    uint to_piece,
+    char **piece_colors,
+    uint num_pieces){
 
-    // geom piece1_orientations[PIECE_ORIENTATIONS_LIMIT];
-    // uint num_piece1_orientations = populate_orientations(piece1_orientations, piece1);
+    for (uint z=0; z<space_depth; ++z){
+        printf(" ┌");
+        for (uint x=0; x<space_width; ++x){
+            printf("───");
+        }
+        printf("┐ ");
+    }
+    printf("\n");
 
-    // printf("Found %u unique orientations.\n", num_piece1_orientations);
 
+    for (uint z=0; z<space_depth; ++z){
+        for (uint y=0; y<space_height; ++y){
+            printf(" │");
+            for (uint x=0; x<space_width; ++x){
+                bool found_match = false;
+                uint matching_piece = 0;
+
+                for (uint i=0; i<to_piece; ++i){
+                    if (geom_has_spot(placed_pieces[i], spot_at(x, y, z))){
+                        matching_piece = i;
+                        found_match = true;
+                        break;
+                    }
+                }
+                if (found_match){
+                    printf(piece_colors[piece_placing_history[matching_piece]]);
+                    if (num_pieces > 10){
+                        printf(" ■ "); // Not printing the piece number when it could be more than 1 digit
+                    } else {
+                        printf(" %u ", piece_placing_history[matching_piece]+1);
+                    }
+                    printf(RESET);
+                } else{
+                    printf("   ");
+                }
+            }
+            printf("│ ");
+        }
+        printf("\n");
+    }
+    for (uint z=0; z<space_depth; ++z){
+        printf(" └");
+        for (uint x=0; x<space_width; ++x){
+            printf("───");
+        }
+        printf("┘ ");
+    }
+    printf("\n");
+}
 
-    // geom piece2_orientations[PIECE_ORIENTATIONS_LIMIT];
-    // uint num_piece2_orientations = populate_orientations(piece2_orientations, piece2);
+/*
+Symmetry breaking: turning or mirroring a solution (as long as the box is the same after)
+gives another solution. So every solution gets found once for each symmetry of the box,
+each time at the cost of searching a whole subtree.
+
+To only find one of each, one piece is restricted to the orientations that are the lowest
+of all the orientations a symmetry can turn them into (its canonical orientations). If the
+piece's orientation is itself symmetric (a symmetry leaves it where it is), a solution can
+still be found several times, so solutions are checked against those symmetries as well
+and only the lowest one is kept.
+
+Only the symmetries that turn the orientations of every piece into the orientations of some
+piece are used. Mirroring only qualifies if every piece has its mirror image amongst the
+pieces (which it's then swapped with).
+*/
 
-    // printf("Found %u unique orientations.\n", num_piece2_orientations);
+#define MAX_SYMMETRIES 48
 
-    #ifndef STOP_AT_FIRST_SOLUTION
-    uint solution_count = 0;
-    #endif
+struct symmetry {
+    uint count; // How many symmetries we're using, starting with doing nothing (the identity)
+    uint cells[MAX_SYMMETRIES][MAX_SPACE_SIZE]; // Which bit each bit of a geom ends up at
+    uint pieces[MAX_SYMMETRIES][MAX_PIECES]; // Which piece each piece turns into
+    uint piece; // The piece restricted to its canonical orientations
+    uint unrestricted_count; // How many orientations it had before
+    bool expand; // Whether to print every symmetric copy of each solution found
+};
 
-    uint piece_history_index = 0; // The number of the piece we're placing (1, 2, 3, ...)
-    uint piece_placing_index = 0; // The index of the piece we're currently trying to place.
-        // Not necessarily equal to piece_history_index
-    #ifndef VERBOSE
-    uint maximum_piece_placing = 0;
-    #endif
-    uint orientation_placing = 0; // The index of the orientation we're trying for the
-        // piece we're trying to place.
+int compare_geoms(const void *a, const void *b){
+    geom first = *(const geom *)a;
+    geom second = *(const geom *)b;
+    return geom_compare(first, second);
+}
 
-    uint orientation_history[NUM_PIECES] = {0}; // Once we've placed a piece using an
-        // orientation, we'll keep track of that orientation's index here, so we can
-        // resume where we left off if necessary.
-    geom space_history[NUM_PIECES] = {0};
+bool is_canonical_orientation(struct symmetry *sym, geom orientation){
+    for (uint g=1; g<sym->count; ++g){
+        if (geom_compare(permute_spots(orientation, sym->cells[g]), orientation) < 0){
+            return false;
+        }
+    }
+    return true;
+}
 
+void symmetry_init(struct symmetry *sym, geom **orientations, uint *orientation_counts){
+    /*
+    Finds the symmetries of the box that keep the pieces the same and restricts the piece that
+    cuts out the most to its canonical orientations (updating orientations and orientation_counts).
+    */
+    uint dimensions[3] = {space_width, space_height, space_depth};
 
-    // Once we've placed a piece, we'll trim down the orientations to those that still fit.
-    // Keeping track of those and the history in this data structure so we can quickly backup
-    // if we need to take out a piece:
-    static geom orientations_history[NUM_PIECES][NUM_PIECES][PIECE_ORIENTATIONS_LIMIT] = {{{0}}};
-    uint orientation_counts_history[NUM_PIECES][NUM_PIECES] = {{0}};
+    // Sorted copies of the orientations so we can quickly look up whether one is amongst them:
+    geom *sorted[MAX_PIECES];
+    for (uint i=0; i<num_pieces; ++i){
+        sorted[i] = malloc(orientation_counts[i] * sizeof(geom));
+        for (uint j=0; j<orientation_counts[i]; ++j){
+            sorted[i][j] = orientations[i][j];
+        }
+        qsort(sorted[i], orientation_counts[i], sizeof(geom), compare_geoms);
+    }
 
-    // We're going to pick the next piece to place based on what we think is fastest.
-    // So it won't necessarily be in order (1, 2, 3, ...). We need to keep track of what
-    // piece we were placing last
-    uint piece_placing_history[NUM_PIECES] = {0};
+    sym->count = 0;
+    for (uint order=0; order<6; ++order){
+        const uint *axes = axis_orders[order];
+        if (dimensions[0] != dimensions[axes[0]] || dimensions[1] != dimensions[axes[1]] || dimensions[2] != dimensions[axes[2]]){
+            continue; // The box wouldn't be the same shape
+        }
+        for (uint mirrored=0; mirrored<8; ++mirrored){ // One bit per axis
+            uint *cells = sym->cells[sym->count];
+            for (uint spot=0; spot<space_size; ++spot){
+                uint *from = spot_coordinates[spot];
+                uint to[3];
+                for (uint axis=0; axis<3; ++axis){
+                    to[axis] = from[axes[axis]];
+                    if (mirrored & (1u << axis)){
+                        to[axis] = dimensions[axis] - 1 - to[axis];
+                    }
+                }
+                cells[spot] = spot_at(to[0], to[1], to[2]);
+            }
 
-    #ifdef TRACK_PROGRESS
-    double permutations_history[NUM_PIECES] = {total_permutations};
+            // Does it turn each piece into one of the pieces?
+            bool used[MAX_PIECES] = {false};
+            bool keeps_pieces = true;
+            for (uint i=0; i<num_pieces && keeps_pieces; ++i){
+                keeps_pieces = false;
+                for (uint j=0; j<num_pieces && !keeps_pieces; ++j){
+                    if (used[j] || orientation_counts[j] != orientation_counts[i]){
+                        continue;
+                    }
+                    keeps_pieces = true;
+                    for (uint k=0; k<orientation_counts[i] && keeps_pieces; ++k){
+                        geom turned = permute_spots(orientations[i][k], cells);
+                        keeps_pieces = bsearch(&turned, sorted[j], orientation_counts[j], sizeof(geom), compare_geoms) != NULL;
+                    }
+                    if (keeps_pieces){
+                        used[j] = true;
+                        sym->pieces[sym->count][i] = j;
+                    }
+                }
+            }
+            if (keeps_pieces){
+                ++sym->count;
+            }
+        }
+    }
+    uint symmetry_count = sym->count;
+
+    // Picking the piece: it has to turn into itself under the symmetries we use. Preferring the
+    // piece that keeps the most symmetries, then the one left with the fewest orientations.
+    // Not a piece with copies, as the symmetries can swap those around:
+    uint best_symmetry_count = 0;
+    uint best_orientation_count = 0;
+    for (uint i=0; i<num_pieces; ++i){
+        if ((i > 0 && piece_groups[i-1] == piece_groups[i]) || (i+1 < num_pieces && piece_groups[i+1] == piece_groups[i])){
+            continue;
+        }
+        struct symmetry candidate;
+        candidate.count = 0;
+        for (uint g=0; g<symmetry_count; ++g){
+            if (sym->pieces[g][i] == i){
+                for (uint n=0; n<space_size; ++n){
+                    candidate.cells[candidate.count][n] = sym->cells[g][n];
+                }
+                ++candidate.count;
+            }
+        }
+        uint canonical_count = 0;
+        for (uint j=0; j<orientation_counts[i]; ++j){
+            canonical_count += is_canonical_orientation(&candidate, orientations[i][j]);
+        }
+        if (candidate.count > best_symmetry_count || (candidate.count == best_symmetry_count && canonical_count < best_orientation_count)){
+            best_symmetry_count = candidate.count;
+            best_orientation_count = canonical_count;
+            sym->piece = i;
+        }
+    }
 
-    long unsigned int backout_no_orientations_left_for_a_piece = 0;
-    long unsigned int backout_some_part_of_space_cannot_be_filled = 0;
-    #ifdef COMMON_PIECE_SIZE
-    long unsigned int backout_are_empty_spaces_factors = 0;
-    #endif
-    #endif
+    if (best_symmetry_count == 0){
+        // Every piece has copies: not breaking symmetry after all (the first symmetry does nothing).
+        sym->piece = 0;
+        symmetry_count = 1;
+    }
 
-    // Populating the initial history record (for piece_placing_index):
-    for (uint i=0; i<NUM_PIECES; ++i){
-        orientation_counts_history[0][i] = orientation_counts[i];
-        for (uint j=0; j<orientation_counts[i]; ++j){
-            orientations_history[0][i][j] = orientations[i][j];
+    // Only keeping the symmetries that turn that piece into itself:
+    sym->count = 0;
+    for (uint g=0; g<symmetry_count; ++g){
+        if (sym->pieces[g][sym->piece] == sym->piece){
+            for (uint n=0; n<space_size; ++n){
+                sym->cells[sym->count][n] = sym->cells[g][n];
+            }
+            for (uint i=0; i<num_pieces; ++i){
+                sym->pieces[sym->count][i] = sym->pieces[g][i];
+            }
+            ++sym->count;
         }
     }
 
-    bool backout = false;
+    sym->unrestricted_count = orientation_counts[sym->piece];
+    uint canonical_count = 0;
+    for (uint j=0; j<sym->unrestricted_count; ++j){
+        if (is_canonical_orientation(sym, orientations[sym->piece][j])){
+            orientations[sym->piece][canonical_count++] = orientations[sym->piece][j];
+        }
+    }
+    orientation_counts[sym->piece] = canonical_count;
 
-    end = clock();
-    duration = ((double) (end - previous)) / CLOCKS_PER_SEC;
-    previous = end;
-    printf("Setup in %.1f seconds.\n", duration);
+    for (uint i=0; i<num_pieces; ++i){
+        free(sorted[i]);
+    }
+}
 
-    while (keep_running) {
+int compare_solutions(struct symmetry *sym, geom *first, geom *second){
+    // Orders solutions (indexed by piece) by the restricted piece first, then in piece order.
+    int order = geom_compare(first[sym->piece], second[sym->piece]);
+    for (uint i=0; i<num_pieces && !order; ++i){
+        order = geom_compare(first[i], second[i]);
+    }
+    return order;
+}
 
-        // First, some checks we want to do each loop:
-        #ifdef VERBOSE
-//           printf("Piece %u, orientation %u.\n", piece_placing+1, orientation_placing+1);
-        #endif
-        SLOW_DOWN();
+uint symmetric_solutions(struct symmetry *sym, geom *placed_pieces, uint *piece_placing_history, geom (*copies)[MAX_PIECES]){
+    /*
+    Returns 0 if a symmetry turns the solution into a lower one (which we'll find and count
+    instead), otherwise how many different solutions it turns into (including itself).
+    If copies isn't NULL, those are put there, indexed by piece.
+    */
+    geom solution[MAX_PIECES];
+    for (uint i=0; i<num_pieces; ++i){
+        solution[piece_placing_history[i]] = placed_pieces[i];
+    }
 
-        if (!keep_running){
-            printf("\nInterupt detected. Exiting.\n");
-            printf("\nPlaced %u pieces.\n", piece_history_index+1);
-            break;
+    uint stabilizer_count = 0; // How many symmetries leave the solution as it is
+    uint copy_count = 0;
+    for (uint g=0; g<sym->count; ++g){
+        geom turned[MAX_PIECES];
+        for (uint i=0; i<num_pieces; ++i){
+            turned[sym->pieces[g][i]] = permute_spots(solution[i], sym->cells[g]);
         }
-        if (print_status){
-            print_status = 0;
-            printf("\nPlaced %u pieces.\n", piece_history_index+1);
-            // print_space(space);
-            // printf("Space by piece number:\n");
-            print_colored_pieces_in_space(orientations_history, orientation_history, piece_placing_history, piece_history_index);
-        }
-
-        ++loop_counter;
-        if (loop_counter % 1000000 == 0){
-            end = clock();
-            duration = ((double) (end - previous)) / CLOCKS_PER_SEC;
-            previous = end;
-            #ifdef TRACK_PROGRESS
-            printf("Tried %e permutations of %e (%.5f %%) in %.1f seconds at a rate of %.2f million loops/second.\n",
-                permutations_tried, total_permutations, permutations_tried / total_permutations * 100.0, duration,
-                ((double)(loop_counter-previous_loop_counter))/duration/1000000.0);
-            // printf("  %.1f % backout_no_orientations_left_for_a_piece\n",
-            //     100.0 * (double)backout_no_orientations_left_for_a_piece / (double)(backout_no_orientations_left_for_a_piece + backout_are_empty_spaces_factors + backout_some_part_of_space_cannot_be_filled));
-            // printf("  %.1f % backout_some_part_of_space_cannot_be_filled\n",
-            //     100.0 * (double)backout_some_part_of_space_cannot_be_filled / (double)(backout_no_orientations_left_for_a_piece + backout_are_empty_spaces_factors + backout_some_part_of_space_cannot_be_filled));
-            // printf("  %.1f % backout_are_empty_spaces_factors\n",
-            //     100.0 * (double)backout_are_empty_spaces_factors / (double)(backout_no_orientations_left_for_a_piece + backout_are_empty_spaces_factors + backout_some_part_of_space_cannot_be_filled));
-            #else
-            printf("%.1f seconds at a rate of %.2f million loops/second.\n", duration,
-                ((double)(loop_counter-previous_loop_counter))/duration/1000000.0);
-            #endif
-            previous_loop_counter = loop_counter;
+        sort_copies(turned);
+        int comparison = compare_solutions(sym, turned, solution);
+        if (comparison < 0){
+            return 0;
         }
-
-        // The actual logic. We do one of two things: backup the piece we placed last or place a new piece:
-        if (backout){ // The latest placed piece makes it impossible to solve the rest in one way or another.
-            backout = false;
-
-            // Trying the next orientation for this same piece.
-            // But wait, have we run out of orientations? If yes, back up to the previous piece.
-            // Doing this in a while loop as that piece might also have run out of orientations:
-            // We need to keep backing up until we find a piece with more orientations.
-            // printf("Piece %u: Couldn't place orientation %u/%u\n", piece_history_index+1, orientation_placing+1, orientation_counts_history[piece_placing][piece_placing]);
-            do{
-                // Backup, takout a piece, and try placing it differently.
-
-                if (piece_history_index == 0){
-                    printf("\nTried all the permutations.\n");
-                    keep_running = 0;
-                    break;
+        if (comparison == 0){
+            ++stabilizer_count;
+        }
+        if (copies){
+            bool seen = false;
+            for (uint c=0; c<copy_count && !seen; ++c){
+                seen = compare_solutions(sym, turned, copies[c]) == 0;
+            }
+            if (!seen){
+                for (uint i=0; i<num_pieces; ++i){
+                    copies[copy_count][i] = turned[i];
                 }
-                --piece_history_index; // Trying to place the previous piece again
-                orientation_placing = orientation_history[piece_history_index]; // Starting back at the orientation we successfully placed.
-                // printf("Back to piece %u at orientation %u/%u\n", piece_history_index+1, orientation_placing+1, orientation_counts_history[piece_history_index][piece_history_index]);
-                space = space_history[piece_history_index]; // Resetting the space to what is was before the previous piece was placed
-                piece_placing_index = piece_placing_history[piece_history_index];
+                ++copy_count;
+            }
+        }
+    }
+    return sym->count / stabilizer_count;
+}
 
-                // Go to the next orientation:
+void print_symmetric_copies(struct symmetry *sym, geom *placed_pieces, uint *piece_placing_history, char **piece_colors){
+    /*
+    Prints the other solutions that the symmetries turn a solution into.
+    */
+    geom copies[MAX_SYMMETRIES][MAX_PIECES];
+    uint copy_count = symmetric_solutions(sym, placed_pieces, piece_placing_history, copies);
+    uint pieces_in_order[MAX_PIECES];
+    for (uint i=0; i<num_pieces; ++i){
+        pieces_in_order[i] = i;
+    }
+    for (uint c=1; c<copy_count; ++c){
+        printf("Symmetric copy %u:\n", c);
+        print_colored_pieces_in_space(copies[c], pieces_in_order, num_pieces, piece_colors, num_pieces);
+    }
+}
+
+double seconds_now(){
+    // Wall clock time. Unlike clock(), doesn't add up the time spent by each thread.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+void print_solution_count(uint solution_count, struct symmetry *symmetry, long unsigned int symmetric_solution_count){
+    if (symmetry){
+        printf("Found %u distinct solutions (%lu counting their symmetric copies).\n", solution_count, symmetric_solution_count);
+    } else {
+        printf("Found %u solutions.\n", solution_count);
+    }
+}
+
+void print_placements_at_depth(long unsigned int *placements_at_depth){
+    // How many times a piece was placed with that many pieces already in: the shape of the tree.
+    printf("Pieces placed at each depth:\n");
+    for (uint i=0; i<num_pieces; ++i){
+        printf("%2u: %lu\n", i+1, placements_at_depth[i]);
+    }
+}
+
+void print_json_string(FILE *file, const char *string){
+    fputc('"', file);
+    for (const char *c=string; *c; ++c){
+        if (*c == '"' || *c == '\\'){
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20){
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+void print_search_stats_json(FILE *file, const struct search_stats *stats){
+    /*
+    Prints stats as the members of a JSON object (without the braces): the pieces placed
+    at each depth, the prunes by reason, the transposition table's counts, the forced
+    placements, the nodes with the holes split up, the placements tried filling pockets
+    and regions, the dead pockets by size and the backjumps by how many placements they
+    jumped past (the ones there were) and the branching histogram, keyed by how many
+    candidates ("1", "2-3", ...) up to the last non-empty bucket.
+    */
+    fprintf(file, "\"placements_at_depth\": [");
+    for (uint i=0; i<num_pieces; ++i){
+        fprintf(file, i ? ", %lu" : "%lu", stats->placements_at_depth[i]);
+    }
+    fprintf(file, "], \"prunes\": {");
+    for (uint i=0; i<PRUNE_REASONS; ++i){
+        fprintf(file, "%s\"%s\": %lu", i ? ", " : "", prune_reason_names[i], stats->prunes[i]);
+    }
+    fprintf(file, "}, \"transpositions\": {\"lookups\": %lu, \"hits\": %lu, \"stores\": %lu, \"replacements\": %lu",
+        stats->transposition_lookups, stats->prunes[PRUNE_TRANSPOSITION], stats->transposition_stores,
+        stats->transposition_replacements);
+    fprintf(file, "}, \"forced\": {\"pieces\": %lu, \"spots\": %lu", stats->forced_pieces, stats->forced_spots);
+    fprintf(file, "}, \"split_nodes\": %lu, \"fill_nodes\": %lu, \"dead_pockets\": {", stats->split_nodes, stats->fill_nodes);
+    bool first = true;
+    for (uint i=0; i<=POCKET_MAX_SPOTS; ++i){
+        if (stats->dead_pockets[i]){
+            fprintf(file, "%s\"%u\": %lu", first ? "" : ", ", i, stats->dead_pockets[i]);
+            first = false;
+        }
+    }
+    fprintf(file, "}, \"backjumps\": {");
+    first = true;
+    for (uint i=0; i<MAX_PIECES; ++i){
+        if (stats->backjumps[i]){
+            fprintf(file, "%s\"%u\": %lu", first ? "" : ", ", i, stats->backjumps[i]);
+            first = false;
+        }
+    }
+    fprintf(file, "}, \"branching\": {");
+    uint bucket_count = BRANCHING_BUCKETS;
+    while (bucket_count > 0 && stats->branching[bucket_count-1] == 0){
+        --bucket_count;
+    }
+    for (uint i=0; i<bucket_count; ++i){
+        uint low = 1u << i;
+        if (i == 0){
+            fprintf(file, "\"1\": %lu", stats->branching[i]);
+        } else if (i == BRANCHING_BUCKETS - 1){
+            fprintf(file, ", \"%u+\": %lu", low, stats->branching[i]);
+        } else {
+            fprintf(file, ", \"%u-%u\": %lu", low, 2*low - 1, stats->branching[i]);
+        }
+    }
+    fprintf(file, "}");
+}
+
+uint solve_with_dlx(geom **orientations, uint *orientation_counts, char **piece_colors, bool print_solutions,
+        uint solutions_to_print, struct symmetry *symmetry, long unsigned int *loop_counter,
+        long unsigned int *symmetric_solution_count, struct search_stats *stats, double *first_solution_at){
+    /*
+    Searches the whole tree with dlx_next_solution(). Returns the number of solutions found,
+    printing the first solutions_to_print of them if print_solutions, and when the first
+    was found (see seconds_now()) in first_solution_at.
+    */
+    clock_t start = clock();
+
+    struct dlx d;
+    dlx_init(&d, orientations, orientation_counts);
+    d.show_progress = print_solutions;
+    geom *placed_pieces = malloc(num_pieces * sizeof(geom));
+    uint *piece_placing_history = malloc(num_pieces * sizeof(uint));
+
+    if (print_solutions){
+        printf("Exact cover setup in %.1f seconds.\n", ((double) (clock() - start)) / CLOCKS_PER_SEC);
+    }
+
+    uint solution_count = 0;
+    *symmetric_solution_count = 0;
+    while (dlx_next_solution(&d)){
+        dlx_get_solution(&d, placed_pieces, piece_placing_history);
+        if (!in_copy_order(placed_pieces, piece_placing_history)){
+            continue; // The same solution with the copies of some piece swapped around
+        }
+        if (symmetry){
+            uint copy_count = symmetric_solutions(symmetry, placed_pieces, piece_placing_history, NULL);
+            if (copy_count == 0){
+                continue;
+            }
+            *symmetric_solution_count += copy_count;
+        }
+        if (++solution_count == 1){
+            *first_solution_at = seconds_now();
+        }
+        #ifdef STOP_AT_FIRST_SOLUTION
+            if (print_solutions){
+                printf("\nStopping at first solution!\n");
+                print_colored_pieces_in_space(placed_pieces, piece_placing_history, d.level, piece_colors, num_pieces);
+            }
+            break;
+        #else
+            if (print_solutions && solution_count <= solutions_to_print){
+                printf("Solution %u:\n", solution_count);
+                print_colored_pieces_in_space(placed_pieces, piece_placing_history, d.level, piece_colors, num_pieces);
+                if (symmetry && symmetry->expand){
+                    print_symmetric_copies(symmetry, placed_pieces, piece_placing_history, piece_colors);
+                }
+            }
+        #endif
+    }
+
+    if (print_solutions && keep_running && !d.found_solution){
+        printf("\nTried all the permutations.\n");
+    }
+
+    *loop_counter = d.loop_counter;
+    *stats = d.stats;
+    free(placed_pieces);
+    free(piece_placing_history);
+    dlx_free(&d);
+    return solution_count;
+}
+
+
+
+/*
+Index of the placements (piece orientations) that fill each spot in the space, so we
+can branch on a spot instead of a piece (see search_find_candidate()).
+
+For each spot, the placements whose lowest spot it is come first: when the spot is the
+lowest empty one, every spot below it is filled, so those are the only ones that fit.
+*/
+
+struct cell_index {
+    uint offsets[MAX_SPACE_SIZE + 1]; // The placements filling spot n are entries offsets[n] through offsets[n+1]-1
+    uint first_counts[MAX_SPACE_SIZE]; // How many of those have spot n as their lowest spot
+    uint *pieces;
+    geom *placements;
+};
+
+void cell_index_init(struct cell_index *index, geom **orientations, uint *orientation_counts){
+    uint counts[MAX_SPACE_SIZE] = {0};
+    for (uint i=0; i<num_pieces; ++i){
+        for (uint j=0; j<orientation_counts[i]; ++j){
+            for (geom g=orientations[i][j]; !geom_is_empty(g); g=geom_without_lowest(g)){
+                ++counts[geom_ctz(g)];
+            }
+        }
+    }
+    index->offsets[0] = 0;
+    for (uint n=0; n<space_size; ++n){
+        index->offsets[n+1] = index->offsets[n] + counts[n];
+    }
+    index->pieces = realloc(index->pieces, index->offsets[space_size] * sizeof(uint));
+    index->placements = realloc(index->placements, index->offsets[space_size] * sizeof(geom));
+
+    // First the placements starting at each spot, then the ones covering it from lower down:
+    uint filled[MAX_SPACE_SIZE] = {0};
+    for (uint lowest_first=1; lowest_first<=2; ++lowest_first){
+        for (uint i=0; i<num_pieces; ++i){
+            for (uint j=0; j<orientation_counts[i]; ++j){
+                geom orientation = orientations[i][j];
+                uint lowest = geom_ctz(orientation);
+                for (geom g=orientation; !geom_is_empty(g); g=geom_without_lowest(g)){
+                    uint n = geom_ctz(g);
+                    if ((n == lowest) == (lowest_first == 1)){
+                        uint entry = index->offsets[n] + filled[n]++;
+                        index->pieces[entry] = i;
+                        index->placements[entry] = orientation;
+                    }
+                }
+            }
+        }
+        if (lowest_first == 1){
+            for (uint n=0; n<space_size; ++n){
+                index->first_counts[n] = filled[n];
+            }
+        }
+    }
+}
+
+void cell_index_free(struct cell_index *index){
+    free(index->pieces);
+    free(index->placements);
+}
+
+/*
+The main search: places pieces one at a time, always picking the piece with the fewest
+orientations left to place next, and backs out the last piece placed as soon as it's
+clear the remaining pieces can't fit.
+
+Everything needed to carry on where we left off is kept in a struct search so that
+several searches can run side by side (see solve_in_parallel()). A search can also be
+started part way down the tree with search_start_at(), only looking at the subtree
+under some placements.
+
+Given a cell_index, it branches on the lowest empty spot instead, trying the placements
+that fill it.
+*/
+
+/*
+Transposition table (--transpositions): the same pieces often fill the same spots in
+different ways or in a different order, which brings the search back to a node it has
+already searched under. What's under a node only depends on the spots filled, which
+pieces are left and, for pieces with copies, where the copies placed so far went (see
+filter_copy_orientations()), so a hash of those is the node's key. The table keeps the
+keys of nodes with nothing under them, so the search can back straight out of them the
+next time rather than trimming the orientations down and searching under them again.
+
+Only dead ends are kept, not how many solutions there were under a node: every solution
+still has to be found to be printed or checked for symmetric copies.
+
+The table has a fixed number of buckets, a cache line each. An entry is one 64 bit word:
+the key, with its bottom bits (which are also used to pick the bucket) replaced by
+roughly how many nodes were searched under it (log2), so that when a bucket is full, the
+node that was quickest to search is the one pushed out. Threads share the table without
+locking, as entries are read and written whole and losing one to a race only means
+searching under a node again. Two nodes could have the same key by chance, but with 64
+bits it's very unlikely to happen in any one search.
+*/
+
+#define TRANSPOSITION_DEFAULT_MEGABYTES 64
+#define TRANSPOSITION_BUCKET_SIZE 8 // Entries per bucket
+#define TRANSPOSITION_WORK_BITS 6
+// Nodes the trimming backs straight out of aren't worth keeping: looking them up (a cache
+// miss) takes about as long as trimming them again.
+#define TRANSPOSITION_MIN_NODES 2
+#define TRANSPOSITION_WORK_MASK ((((uint64_t)1) << TRANSPOSITION_WORK_BITS) - 1)
+
+struct transposition_table {
+    uint64_t *entries; // NULL when there isn't one. 0 for an empty entry
+    uint64_t bucket_mask; // How many buckets there are (a power of 2), less one
+    size_t size; // In bytes
+};
+
+struct transposition_table transpositions;
+
+void transpositions_reset(size_t megabytes){
+    /*
+    Empties the table for a new search, making it the largest power of 2 buckets in
+    megabytes (freeing it for 0).
+    */
+    size_t bucket_size = TRANSPOSITION_BUCKET_SIZE * sizeof(uint64_t);
+    size_t bucket_count = 0;
+    if (megabytes >= 1){
+        bucket_count = 1;
+        while (bucket_count * 2 * bucket_size <= (megabytes << 20)){
+            bucket_count *= 2;
+        }
+    }
+    if (bucket_count * bucket_size != transpositions.size){
+        free(transpositions.entries);
+        transpositions.entries = NULL;
+        transpositions.size = 0;
+        if (bucket_count == 0){
+            return;
+        }
+        void *entries;
+        if (posix_memalign(&entries, bucket_size, bucket_count * bucket_size) != 0){
+            printf("Can't allocate a %zu MB transposition table: going without.\n", megabytes);
+            return;
+        }
+        transpositions.entries = entries;
+        transpositions.size = bucket_count * bucket_size;
+        transpositions.bucket_mask = bucket_count - 1;
+    }
+    memset(transpositions.entries, 0, transpositions.size);
+}
+
+static inline uint64_t transposition_piece_key(uint piece, geom placed){
+    // What placing piece at placed adds to the key (by xor): where it is only matters for copies.
+    bool has_copies = piece_groups[piece] != piece || (piece + 1 < num_pieces && piece_groups[piece + 1] == piece);
+    return mix64(((uint64_t)(piece + 1) << 32) | (has_copies ? geom_ctz(placed) + 1 : 0));
+}
+
+static inline uint64_t *transposition_bucket(uint64_t key){
+    return transpositions.entries + (key & transpositions.bucket_mask) * TRANSPOSITION_BUCKET_SIZE;
+}
+
+static inline bool transpositions_find(uint64_t key){
+    // Whether key is in the table: a node with nothing under it.
+    uint64_t *bucket = transposition_bucket(key);
+    uint64_t tag = key & ~TRANSPOSITION_WORK_MASK;
+    for (uint i=0; i<TRANSPOSITION_BUCKET_SIZE; ++i){
+        uint64_t entry = __atomic_load_n(&bucket[i], __ATOMIC_RELAXED);
+        if (entry && (entry & ~TRANSPOSITION_WORK_MASK) == tag){
+            return true;
+        }
+    }
+    return false;
+}
+
+void transpositions_add(uint64_t key, long unsigned int nodes, struct search_stats *stats){
+    // Adds key, a node with nothing under it that took searching nodes nodes to find out.
+    uint64_t *bucket = transposition_bucket(key);
+    uint64_t work = (uint64_t)(64 - __builtin_clzl(nodes | 1)); // 1 to 64
+    uint64_t entry = (key & ~TRANSPOSITION_WORK_MASK) | (work < TRANSPOSITION_WORK_MASK ? work : TRANSPOSITION_WORK_MASK);
+    uint replacing = 0;
+    uint64_t least_work = UINT64_MAX;
+    for (uint i=0; i<TRANSPOSITION_BUCKET_SIZE; ++i){
+        uint64_t existing = __atomic_load_n(&bucket[i], __ATOMIC_RELAXED);
+        if ((existing & TRANSPOSITION_WORK_MASK) < least_work){
+            least_work = existing & TRANSPOSITION_WORK_MASK;
+            replacing = i;
+        }
+    }
+    __atomic_store_n(&bucket[replacing], entry, __ATOMIC_RELAXED);
+    ++stats->transposition_stores;
+    if (least_work != 0){
+        ++stats->transposition_replacements;
+    }
+}
+
+
+#define SEARCH_DONE 0 // Tried all the permutations (or we were interupted)
+#define SEARCH_SOLUTION 1 // All the pieces are placed
+#define SEARCH_FRONTIER 2 // Reached stop_at_depth (or stop_at_spot): the pieces placed so far are the root of a subtree we're not going into
+#define SEARCH_PAUSED 3 // Did pause_every loops. Call search_next() again to carry on
+
+struct search {
+    geom **orientations; // Every orientation of every piece
+    uint *orientation_counts;
+    char **piece_colors;
+    struct cell_index *cell_index; // NULL to branch on pieces rather than spots
+
+    geom space;
+    bool backout;
+
+    uint piece_history_index; // The number of the piece we're placing (1, 2, 3, ...)
+    uint piece_placing_index; // The index of the piece we're currently trying to place.
+        // Not necessarily equal to piece_history_index
+    uint orientation_placing; // The index of the orientation we're trying for the
+        // piece we're trying to place.
+
+    uint root_piece_history_index; // We're only searching under the pieces placed before this one.
+    uint stop_at_depth; // Don't go deeper than placing this many pieces: return SEARCH_FRONTIER instead. 0 to go all the way.
+    uint stop_at_spot; // With a cell_index, return SEARCH_FRONTIER once the spots before this one are filled. 0 to go all the way.
+    uint pause_every; // Return SEARCH_PAUSED after this many loops. 0 to never pause.
+    uint loops_until_pause;
+    bool show_progress; // Print the loop rate and respond to SIGUSR1
+
+    uint orientation_history[MAX_PIECES]; // Once we've placed a piece using an
+        // orientation, we'll keep track of that orientation's index here, so we can
+        // resume where we left off if necessary.
+    geom space_history[MAX_PIECES];
+    geom placed_history[MAX_PIECES]; // The orientation (geometry) of each piece placed
+
+    // We're going to pick the next piece to place based on what we think is fastest.
+    // So it won't necessarily be in order (1, 2, 3, ...). We need to keep track of what
+    // piece we were placing last
+    uint piece_placing_history[MAX_PIECES];
+
+    // When branching on spots, the spot filled at each level, and where its placements
+    // stop (orientation_placing is then the entry in the cell_index for the spot):
+    uint cell_history[MAX_PIECES];
+    uint cell_candidates_end[MAX_PIECES];
+
+    // Once we've placed a piece, we'll trim down the orientations to those that still fit.
+    // Each piece's orientations are kept in one array, with the ones that no longer fit
+    // moved to the end: the first orientation_counts_history[n][i] of candidates[i] are
+    // the ones that fit after placing n pieces. Backing up is just going back to the
+    // counts at the previous level, as the ones that fit there are still at the front.
+    geom *candidates[MAX_PIECES];
+    geom *candidate_store; // All of candidates[] in one block, reused between searches
+    uint candidate_store_size;
+    geom *overlapping; // Scratch space for filter_orientations(), at the end of candidate_store
+    uint orientation_counts_history[MAX_PIECES][MAX_PIECES];
+
+    // With track_coverage, how many of the orientations that still fit cover each spot at
+    // each level. Trimming orientations takes them out of the counts, so a spot nothing can
+    // fill anymore shows up as soon as its count gets to 0 (see search_uncover()), rather
+    // than by ORing together every orientation left and comparing that with the full space.
+    // That takes longer with the SIMD filters doing the ORing as they go, so it's optional.
+    // The spots whose counts are 0, filled or not, are kept as a geom too.
+    uint coverage_history[MAX_PIECES][MAX_SPACE_SIZE];
+    geom uncovered_history[MAX_PIECES];
+
+    // With a transposition table, each level's key, and the loops and leaves (solutions and
+    // frontiers) counted when we got to it, to tell when we back out of it whether anything
+    // was found under it. The root, levels split off for another search and levels from
+    // before resuming a checkpoint haven't been searched completely here, so they aren't
+    // remembered (remember_history[] is false).
+    uint64_t placed_key_history[MAX_PIECES]; // What the pieces placed before each level add to its key
+    uint64_t key_history[MAX_PIECES];
+    long unsigned int loops_history[MAX_PIECES];
+    long unsigned int leaves_history[MAX_PIECES];
+    bool remember_history[MAX_PIECES];
+    long unsigned int leaf_counter;
+
+    // For backjumping, the placements (a bit for each level) that explain why nothing's
+    // been found under each level so far, and why the node last backed out of went
+    // nowhere (see search_next()).
+    uint64_t conflict_history[MAX_PIECES];
+    uint64_t conflict;
+
+    long unsigned int loop_counter;
+    long unsigned int previous_loop_counter;
+    struct search_stats stats; // Not counting what search_start_at() does
+    clock_t previous; // When we last printed progress
+    #ifndef VERBOSE
+    uint maximum_piece_placing;
+    #endif
+
+    #ifdef DEBUG_SOLUTION
+    geom *solution;
+    #endif
+};
+
+bool search_find_candidate(struct search *s){
+    /*
+    Makes sure orientation_placing is an orientation we can place at this level, moving on
+    to the next one if need be. Returns false if we've run out.
+    */
+    uint piece_history_index = s->piece_history_index;
+    if (!s->cell_index){
+        // The orientations of the piece have already been trimmed down to the ones that fit:
+        return s->orientation_placing < s->orientation_counts_history[piece_history_index][s->piece_placing_index];
+    }
+
+    uint *orientation_counts = s->orientation_counts_history[piece_history_index];
+    uint first = s->cell_index->offsets[s->cell_history[piece_history_index]];
+    for (; s->orientation_placing<s->cell_candidates_end[piece_history_index]; ++s->orientation_placing){
+        uint entry = first + s->orientation_placing;
+        uint piece = s->cell_index->pieces[entry];
+        // Zero orientations is the sentinel for already placed. The copies of a piece go in
+        // order of their lowest spot, which is the order we fill the spots in:
+        if (orientation_counts[piece] && !geom_overlaps(s->space, s->cell_index->placements[entry])
+                && (piece == 0 || piece_groups[piece-1] != piece_groups[piece] || !orientation_counts[piece-1])){
+            return true;
+        }
+    }
+    return false;
+}
+
+void search_choose_cell(struct search *s){
+    // Picks the lowest empty spot to fill next.
+    uint piece_history_index = s->piece_history_index;
+    uint cell = geom_ctz(~s->space & full_space_mask);
+    s->cell_history[piece_history_index] = cell;
+    s->cell_candidates_end[piece_history_index] = s->cell_index->first_counts[cell];
+    s->orientation_placing = 0;
+    if (!search_find_candidate(s)){
+        #ifdef VERBOSE
+        printf("Backing out: nothing fits in spot %u.\n", cell);
+        #endif
+        s->backout = true;
+        ++s->stats.prunes[PRUNE_NOTHING_FITS_SPOT];
+        return;
+    }
+    count_branching(&s->stats, s->cell_candidates_end[piece_history_index]);
+}
+
+uint *search_candidates_end(struct search *s, uint piece_history_index){
+    // Where the orientations (or spot placements) to try at the given level stop.
+    if (s->cell_index){
+        return &s->cell_candidates_end[piece_history_index];
+    }
+    return &s->orientation_counts_history[piece_history_index][s->piece_placing_history[piece_history_index]];
+}
+
+void search_count_coverage(struct search *s, uint piece_history_index){
+    // Works out the coverage counts at the given level from scratch.
+    uint *coverage = s->coverage_history[piece_history_index];
+    memset(coverage, 0, space_size * sizeof(uint));
+    for (uint i=0; i<num_pieces; ++i){
+        geom *orientations = s->candidates[i];
+        for (uint j=0; j<s->orientation_counts_history[piece_history_index][i]; ++j){
+            for (geom left=orientations[j]; !geom_is_empty(left); left=geom_without_lowest(left)){
+                ++coverage[geom_ctz(left)];
+            }
+        }
+    }
+    geom uncovered = GEOM_EMPTY;
+    for (uint spot=0; spot<space_size; ++spot){
+        if (coverage[spot] == 0){
+            uncovered |= geom_bit(spot);
+        }
+    }
+    s->uncovered_history[piece_history_index] = uncovered;
+}
+
+static inline geom search_uncover(uint *coverage, geom *orientations, uint count){
+    // Takes the orientations out of the coverage counts, returning the spots that leaves uncovered.
+    geom uncovered = GEOM_EMPTY;
+    for (uint j=0; j<count; ++j){
+        for (geom left=orientations[j]; !geom_is_empty(left); left=geom_without_lowest(left)){
+            uint spot = geom_ctz(left);
+            if (--coverage[spot] == 0){
+                uncovered |= geom_bit(spot);
+            }
+        }
+    }
+    return uncovered;
+}
+
+void search_start(struct search *s, geom **orientations, uint *orientation_counts, char **piece_colors,
+        struct cell_index *cell_index){
+    /*
+    Sets up s to search the whole tree, starting by placing the first piece (or filling
+    the first spot, with a cell_index).
+
+    s has to start out zeroed and be freed with search_free().
+    */
+    s->orientations = orientations;
+    s->orientation_counts = orientation_counts;
+    s->piece_colors = piece_colors;
+    s->cell_index = cell_index;
+
+    s->space = GEOM_EMPTY;
+    s->backout = false;
+    s->piece_history_index = 0;
+    s->piece_placing_index = 0;
+    s->orientation_placing = 0;
+    s->root_piece_history_index = 0;
+    s->stop_at_depth = 0;
+    s->stop_at_spot = 0;
+    s->pause_every = 0;
+    s->loops_until_pause = 0;
+    s->show_progress = true;
+    s->piece_placing_history[0] = 0;
+    s->placed_key_history[0] = 0;
+    memset(s->remember_history, 0, sizeof(s->remember_history));
+    s->leaf_counter = 0;
+
+    s->loop_counter = 0;
+    s->previous_loop_counter = 0;
+    memset(&s->stats, 0, sizeof(s->stats));
+    s->previous = clock();
+    #ifndef VERBOSE
+    s->maximum_piece_placing = 0;
+    #endif
+
+    // Populating the initial history record (for piece_placing_index):
+    uint total_orientation_count = 0;
+    uint most_orientations = 0;
+    for (uint i=0; i<num_pieces; ++i){
+        total_orientation_count += orientation_counts[i];
+        if (orientation_counts[i] > most_orientations){
+            most_orientations = orientation_counts[i];
+        }
+    }
+    if (total_orientation_count + most_orientations > s->candidate_store_size){
+        s->candidate_store_size = total_orientation_count + most_orientations;
+        s->candidate_store = realloc(s->candidate_store, s->candidate_store_size * sizeof(geom));
+    }
+    s->overlapping = s->candidate_store + total_orientation_count;
+    geom *candidates = s->candidate_store;
+    for (uint i=0; i<num_pieces; ++i){
+        s->candidates[i] = candidates;
+        s->orientation_counts_history[0][i] = orientation_counts[i];
+        memcpy(candidates, orientations[i], orientation_counts[i] * sizeof(geom));
+        candidates += orientation_counts[i];
+    }
+    if (track_coverage){
+        search_count_coverage(s, 0);
+    }
+
+    if (cell_index){
+        search_choose_cell(s);
+    } else if (orientation_counts[0] > 0){
+        count_branching(&s->stats, orientation_counts[0]);
+    }
+}
+
+void search_free(struct search *s){
+    free(s->candidate_store);
+    free(s);
+}
+
+uint filter_copy_orientations(geom *orientations, uint count, uint lowest, bool above, geom *overlapping){
+    /*
+    Like filter_orientations(), but keeping the orientations whose lowest spot is above
+    lowest (or below, if not above): where a copy of a piece can go given where another
+    copy went (see in_copy_order()).
+    */
+    uint kept = 0;
+    uint dropped = 0;
+    for (uint i=0; i<count; ++i){
+        geom orientation = orientations[i];
+        if ((geom_ctz(orientation) > lowest) == above){
+            orientations[kept++] = orientation;
+        } else {
+            overlapping[dropped++] = orientation;
+        }
+    }
+    memcpy(orientations + kept, overlapping, dropped * sizeof(geom));
+    return kept;
+}
+
+bool search_fill_pocket(struct search *s, geom pocket, uint64_t used){
+    /*
+    Whether the orientations left at this level can fill pocket exactly, without using the
+    pieces in used (a bit for each) or more than one orientation of any piece. Filling the
+    lowest spot first, as the pocket's only a few pieces big.
+    */
+    if (geom_is_empty(pocket)){
+        return true;
+    }
+    geom lowest = geom_lowest(pocket);
+    uint *orientation_counts = s->orientation_counts_history[s->piece_history_index];
+    for (uint i=0; i<num_pieces; ++i){
+        if (used & ((uint64_t)1 << i)){
+            continue;
+        }
+        geom *orientations = s->candidates[i];
+        for (uint j=0; j<orientation_counts[i]; ++j){
+            geom orientation = orientations[j];
+            if (geom_overlaps(orientation, lowest) && geom_is_empty(orientation & ~pocket)){
+                ++s->stats.fill_nodes;
+                if (search_fill_pocket(s, pocket & ~orientation, used | ((uint64_t)1 << i))){
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool search_has_dead_pocket(struct search *s){
+    /*
+    Whether placing the last piece has walled off a pocket of at most POCKET_MAX_SPOTS
+    empty spots that the pieces left can't fill (counting it in the stats by size).
+
+    A pocket the size of one piece is already caught by the check that every spot can be
+    filled: only orientations that fit it exactly can fill any of it. Bigger ones can have
+    every spot fillable without the pieces fitting together, like two pentominoes' worth
+    that no two of the pieces left make.
+    */
+    geom holes = ~s->space & full_space_mask;
+    geom around = grow_into_neighbours(s->placed_history[s->piece_history_index-1]) & holes;
+    while (!geom_is_empty(around)){
+        geom pocket = geom_lowest(around);
+        geom grown;
+        uint size;
+        while (!geom_equal(grown = grow_into_neighbours(pocket) & holes, pocket)
+                && geom_popcount(grown) <= POCKET_MAX_SPOTS){
+            pocket = grown;
+        }
+        // (If it's all that's left, that's what the search is about to find out anyway.)
+        if (geom_equal(grown, pocket) && !geom_equal(pocket, holes) && (size = geom_popcount(pocket)) > common_piece_size){
+            if (!search_fill_pocket(s, pocket, 0)){
+                ++s->stats.dead_pockets[size];
+                return true;
+            }
+        }
+        around &= ~grown;
+    }
+    return false;
+}
+
+bool search_has_dead_regions(struct search *s){
+    /*
+    Called when the holes have split up into more than one region: whether the pieces left
+    can't fill every region but the biggest between them, each piece going in one.
+
+    No piece can reach from one region into another, so what goes in each only depends on
+    which pieces the others use. Trying to fill the smaller ones straight away, rather than
+    as the search wanders between regions, catches them going nowhere before the biggest
+    one is searched under every way of getting there. It finds out at the first way of
+    filling them that works, which doesn't take long for the regions left beside the big one.
+    When they add up to more than REGIONS_MAX_SPOTS spots, it leaves them to the search:
+    filling them would take about as long as searching them.
+    */
+    geom holes = ~s->space & full_space_mask;
+    geom biggest = GEOM_EMPTY;
+    uint biggest_size = 0;
+    for (geom left=holes; !geom_is_empty(left); ){
+        geom region = geom_lowest(left);
+        geom grown;
+        while (!geom_equal(grown = grow_into_neighbours(region) & holes, region)){
+            region = grown;
+        }
+        uint size = geom_popcount(region);
+        if (size > biggest_size){
+            biggest = region;
+            biggest_size = size;
+        }
+        left &= ~region;
+    }
+    geom smaller = holes & ~biggest;
+    return geom_popcount(smaller) <= REGIONS_MAX_SPOTS && !search_fill_pocket(s, smaller, 0);
+}
+
+bool search_force_spot(struct search *s, uint *piece){
+    /*
+    Looks for an empty spot that only one of the orientations left can fill, when the
+    pieces fill the space: that orientation has to be placed, so if there is one, its
+    piece is the only one tried next (*piece), with just that orientation. Returns false
+    if there isn't one, or if there is but dropping the piece's other orientations leaves
+    some spot nothing can fill (setting backout).
+    */
+    uint piece_history_index = s->piece_history_index;
+    uint *orientation_counts = s->orientation_counts_history[piece_history_index];
+    geom holes = ~s->space & full_space_mask;
+    geom covered_once = GEOM_EMPTY;
+    geom piece_fills[MAX_PIECES]; // Without track_coverage, what each piece's orientations left cover
+    if (track_coverage){
+        uint *coverage = s->coverage_history[piece_history_index];
+        for (geom left=holes; !geom_is_empty(left); left=geom_without_lowest(left)){
+            if (coverage[geom_ctz(left)] == 1){
+                covered_once = geom_lowest(left);
+                break;
+            }
+        }
+    } else {
+        geom covered = GEOM_EMPTY;
+        geom covered_twice = GEOM_EMPTY;
+        for (uint i=0; i<num_pieces; ++i){
+            geom *orientations = s->candidates[i];
+            geom piece_fill = GEOM_EMPTY;
+            for (uint j=0; j<orientation_counts[i]; ++j){
+                covered_twice |= covered & orientations[j];
+                covered |= orientations[j];
+                piece_fill |= orientations[j];
+            }
+            piece_fills[i] = piece_fill;
+        }
+        covered_once = geom_lowest(holes & ~covered_twice);
+    }
+    if (geom_is_empty(covered_once)){
+        return false;
+    }
+
+    for (uint i=0; i<num_pieces; ++i){
+        geom *orientations = s->candidates[i];
+        for (uint j=0; j<orientation_counts[i]; ++j){
+            if (!geom_overlaps(orientations[j], covered_once)){
+                continue;
+            }
+            // Moving it to the front and leaving the others for the levels above:
+            geom forced = orientations[j];
+            orientations[j] = orientations[0];
+            orientations[0] = forced;
+            if (track_coverage){
+                s->uncovered_history[piece_history_index] |= search_uncover(s->coverage_history[piece_history_index],
+                    orientations + 1, orientation_counts[i] - 1);
+                if (geom_overlaps(s->uncovered_history[piece_history_index], holes)){
+                    s->backout = true;
+                    ++s->stats.prunes[PRUNE_UNFILLABLE_SPOT];
+                    return false;
+                }
+            } else {
+                // What's left covers, with just the forced orientation for its piece:
+                geom fill = s->space | forced;
+                for (uint k=0; k<num_pieces; ++k){
+                    if (k != i){
+                        fill |= piece_fills[k];
+                    }
+                }
+                if (!geom_equal(fill, full_space_mask)){
+                    s->backout = true;
+                    ++s->stats.prunes[PRUNE_UNFILLABLE_SPOT];
+                    return false;
+                }
+            }
+            orientation_counts[i] = 1;
+            *piece = i;
+            ++s->stats.forced_spots;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline uint64_t levels_below(uint level){
+    // A bit for each placement before the given level: all of them to blame.
+    return level < 64 ? ((uint64_t)1 << level) - 1 : ~(uint64_t)0;
+}
+
+uint64_t search_eliminated_by(struct search *s, uint piece, uint level){
+    /*
+    The placements before the given level that took away some of a piece's orientations
+    (a bit for each level). Each level's trimming only drops the orientations the piece
+    just placed overlaps, or that would put copies of it out of order, so between them
+    these placements are why the piece has none of the others.
+    */
+    uint64_t levels = 0;
+    for (uint i=0; i<level; ++i){
+        if (s->orientation_counts_history[i+1][piece] < s->orientation_counts_history[i][piece]){
+            levels |= (uint64_t)1 << i;
+        }
+    }
+    return levels;
+}
+
+void search_trim_orientations(struct search *s){
+    /*
+    Called after placing a piece (and moving piece_history_index on to the next one).
+
+    Trims down the orientations of the remaining pieces to those that still fit, checks
+    whether it's still possible to place them all (setting backout if not) and picks the
+    piece to place next.
+    */
+    uint piece_history_index = s->piece_history_index;
+    geom space = s->space;
+
+    geom potential_space_fill = space;
+    uint *coverage = s->coverage_history[piece_history_index];
+    geom uncovered = s->uncovered_history[piece_history_index-1];
+    geom holes = ~space & full_space_mask;
+    if (track_coverage){
+        memcpy(coverage, s->coverage_history[piece_history_index-1], space_size * sizeof(uint));
+    }
+
+    // Trimming down what remaining pieces and orientations we have:
+    // Also, if a piece doesn't fit anymore, we backout.
+    uint *orientations_counts_at_previous_piece = s->orientation_counts_history[piece_history_index-1];
+    uint *orientations_counts_at_this_piece = s->orientation_counts_history[piece_history_index];
+    uint smallest_orientations_count = 10000;
+    uint piece_placing_index_for_smallest_orientations_count = 0;
+    uint placed_piece = s->piece_placing_index;
+    uint piece_count = num_pieces;
+    if (backjump){
+        s->conflict = levels_below(piece_history_index); // Unless it's down to a piece running out of orientations
+    }
+    for (uint i=0; i<piece_count; ++i){ // Loop over all pieces
+        if (i == placed_piece || orientations_counts_at_previous_piece[i] == 0){ // Zero here is a sentinel for already placed
+            orientations_counts_at_this_piece[i] = 0; // Setting the sentinel of 0 to mena already placed.
+            if (i == placed_piece && track_coverage){
+                uncovered |= search_uncover(coverage, s->candidates[i], orientations_counts_at_previous_piece[i]);
+            }
+            continue; // Only worrying about the  remaining pieces
+        }
+        uint orientation_count = orientations_counts_at_previous_piece[i];
+        if (piece_groups[i] == piece_groups[placed_piece]){
+            // A copy of the piece just placed:
+            orientation_count = filter_copy_orientations(s->candidates[i], orientation_count,
+                geom_ctz(s->placed_history[piece_history_index-1]), i > placed_piece, s->overlapping);
+        }
+        // Keeping the orientations that still fit at the front:
+        uint new_orientation_count = filter_orientations(s->candidates[i], orientation_count, space,
+            &potential_space_fill, s->overlapping);
+        orientations_counts_at_this_piece[i] = new_orientation_count;
+
+        // Checking if it's still possible to fill in every spot in the space. The orientations
+        // that don't fit anymore are behind the ones that do:
+        if (track_coverage){
+            uncovered |= search_uncover(coverage, s->candidates[i] + new_orientation_count,
+                orientations_counts_at_previous_piece[i] - new_orientation_count);
+            if (geom_overlaps(uncovered, holes)){
+                #ifdef VERBOSE
+                printf("Backing out: some part of space cannot be filled.\n");
+                #endif
+                s->backout = true;
+                ++s->stats.prunes[PRUNE_UNFILLABLE_SPOT];
+                break;
+            }
+        }
+
+        if (new_orientation_count == 0){ // Some piece does not fit anymore
+            #ifdef VERBOSE
+            printf("Backing out: no orientations left for piece %u.\n", i+1);
+            #endif
+            s->backout = true;
+            ++s->stats.prunes[PRUNE_NO_ORIENTATIONS];
+            if (backjump){
+                s->conflict = search_eliminated_by(s, i, piece_history_index);
+            }
+            break;
+        }
+
+        // Tracking which piece has the fewest orientations left so we can try it next for speed:
+        if (new_orientation_count < smallest_orientations_count){
+            smallest_orientations_count = new_orientation_count;
+            piece_placing_index_for_smallest_orientations_count = i;
+        }
+    }
+
+    // Checking if it's still possible to fill in every spot in the space (with
+    // track_coverage, the piece just placed might have been the last one looked at):
+    if (space_will_be_full && !s->backout && (track_coverage ? geom_overlaps(uncovered, holes)
+            : !geom_equal(potential_space_fill, full_space_mask))){
+        #ifdef VERBOSE
+        printf("Backing out: some part of space cannot be filled.\n");
+        #endif
+        s->backout = true;
+        ++s->stats.prunes[PRUNE_UNFILLABLE_SPOT];
+    }
+    s->uncovered_history[piece_history_index] = uncovered;
+
+    // Checking if it's still possible to fit the pieces into the divisions in the space:
+    #ifdef CHECK_HOLE_SIZES
+    uint regions = 1; // Of holes, if one of the checks floods them
+    if (check_hole_sizes && !s->backout && !are_empty_spaces_factors(space, &regions)){
+        // If all our pieces are of size 3 unit cubes (for example) and we've split the space into two (or more)
+        // separate holes, the space isn't solvable unless each of those holes has a number of unit cubes
+        // that's a multiple of 3.
+        #ifdef VERBOSE
+        printf("Backing out: empty spaces are not factors.");
+        #endif
+        s->backout = true;
+        ++s->stats.prunes[PRUNE_HOLE_SIZES];
+    }
+    if (check_hole_sums && !s->backout && !are_empty_spaces_sums(space, subset_sums(orientations_counts_at_this_piece), &regions)){
+        // The same, for pieces of different sizes: the holes have to be sizes some of the pieces left add up to.
+        #ifdef VERBOSE
+        printf("Backing out: empty spaces are not sums of pieces.");
+        #endif
+        s->backout = true;
+        ++s->stats.prunes[PRUNE_HOLE_SIZES];
+    }
+    #endif
+
+    // Checking that any small pocket the piece walled off can still be filled:
+    if (space_will_be_full && !s->backout && search_has_dead_pocket(s)){
+        #ifdef VERBOSE
+        printf("Backing out: a pocket can't be filled by the pieces left.\n");
+        #endif
+        s->backout = true;
+        ++s->stats.prunes[PRUNE_DEAD_POCKET];
+    }
+
+    // And that the pieces left can be shared out between the regions the holes are in:
+    #ifdef CHECK_HOLE_SIZES
+    if (regions > 1 && !s->backout){
+        ++s->stats.split_nodes;
+        if (search_has_dead_regions(s)){
+            #ifdef VERBOSE
+            printf("Backing out: the pieces left can't fill the smaller regions of holes.\n");
+            #endif
+            s->backout = true;
+            ++s->stats.prunes[PRUNE_DEAD_REGIONS];
+        }
+    }
+    #endif
+
+    if (s->cell_index){
+        if (backjump){
+            // The spot's placements that don't fit aren't kept track of, so it's all to blame:
+            s->conflict_history[piece_history_index] = levels_below(piece_history_index);
+        }
+        if (!s->backout){
+            search_choose_cell(s);
+        }
+        return;
+    }
+
+    // Figure out the best order to try and place the remaining pieces in:
+    #ifdef VERBOSE
+    if (!s->backout){
+        printf("Decided to place piece %u next (%u orientations).\n",
+            piece_placing_index_for_smallest_orientations_count+1,
+            s->orientation_counts_history[piece_history_index][piece_placing_index_for_smallest_orientations_count]);
+    }
+    #endif
+    if (backjump){
+        s->conflict_history[piece_history_index] = 0;
+    }
+    if (!s->backout && smallest_orientations_count == 1){
+        ++s->stats.forced_pieces;
+    } else if (!s->backout && force_spots && space_will_be_full
+            && search_force_spot(s, &piece_placing_index_for_smallest_orientations_count)){
+        smallest_orientations_count = 1;
+        if (backjump){
+            // Why the piece can only go there is down to every other orientation that could
+            // fill the spot, so it's all to blame:
+            s->conflict_history[piece_history_index] = levels_below(piece_history_index);
+        }
+    }
+    s->piece_placing_index = piece_placing_index_for_smallest_orientations_count;
+    s->piece_placing_history[piece_history_index] = s->piece_placing_index;
+    if (!s->backout){
+        count_branching(&s->stats, smallest_orientations_count);
+    }
+}
+
+double search_progress(struct search *s){
+    /*
+    Roughly how much of the tree (under the root, for search_start_at()) has been searched,
+    from 0 to 1: each level's share of what's left of the level above, going by which of
+    its candidates it's on, as if every candidate's subtree was the same size.
+    */
+    double progress = 0;
+    double share = 1;
+    for (uint i=s->root_piece_history_index; i<s->piece_history_index; ++i){
+        uint candidate_count = *search_candidates_end(s, i);
+        if (candidate_count == 0){
+            break;
+        }
+        share /= candidate_count;
+        progress += share * s->orientation_history[i];
+    }
+    return progress;
+}
+
+void search_start_at(struct search *s, uint depth, uint *pieces, geom *placed, uint next, geom *candidates, uint first, uint last){
+    /*
+    Sets up s to only search the subtree under the given placements: depth pieces already
+    placed (pieces[i] with orientation placed[i]), with piece next placed next in one of
+    candidates (last - first of them).
+
+    With a cell_index, spot next is filled next instead, trying its entries first through
+    last-1, and candidates isn't used.
+
+    s has to have been set up with search_start() first.
+    */
+    for (uint i=0; i<depth; ++i){
+        s->piece_placing_index = pieces[i];
+        s->piece_placing_history[i] = pieces[i];
+        s->orientation_history[i] = 0;
+        s->space_history[i] = s->space;
+        s->placed_history[i] = placed[i];
+        s->space |= placed[i];
+        s->placed_key_history[i+1] = s->placed_key_history[i] ^ transposition_piece_key(pieces[i], placed[i]);
+        ++s->piece_history_index;
+        search_trim_orientations(s);
+    }
+    s->root_piece_history_index = depth;
+    s->backout = false;
+    memset(&s->stats, 0, sizeof(s->stats)); // What's above the root is counted by whoever split the tree
+    s->conflict_history[depth] = levels_below(depth); // Only some of its candidates are tried here
+    if (s->cell_index){
+        s->cell_history[depth] = next;
+        s->cell_candidates_end[depth] = last;
+        s->orientation_placing = first;
+        s->backout = !search_find_candidate(s);
+        return;
+    }
+    s->piece_placing_index = next;
+    s->piece_placing_history[depth] = next;
+    // The candidates are some of the orientations that fit at this level: moving them to the front.
+    geom *piece_orientations = s->candidates[next];
+    uint orientation_count = s->orientation_counts_history[depth][next];
+    for (uint j=0; j<last-first; ++j){
+        for (uint k=j; k<orientation_count; ++k){
+            if (geom_equal(piece_orientations[k], candidates[j])){
+                piece_orientations[k] = piece_orientations[j];
+                piece_orientations[j] = candidates[j];
+                break;
+            }
+        }
+    }
+    s->orientation_counts_history[depth][next] = last - first;
+    s->orientation_placing = 0;
+    if (track_coverage){
+        // The other orientations of the piece aren't tried here, so they don't cover anything:
+        s->uncovered_history[depth] |= search_uncover(s->coverage_history[depth], piece_orientations + (last - first),
+            orientation_count - (last - first));
+    }
+}
+
+void search_start_filled(struct search *s, geom filled, uint64_t placed){
+    /*
+    Sets up s to search the rest of the tree from the spots in filled being filled by the
+    pieces in placed (a bit for each), with a cell_index. Which piece went where isn't
+    known, so only the pieces placed from here on can be printed.
+
+    s has to have been set up with search_start() first, but only once for any number of
+    these: its loop_counter and stats carry on adding up.
+    */
+    uint depth = (uint)__builtin_popcountll(placed);
+    s->space = filled;
+    s->backout = false;
+    s->piece_history_index = depth;
+    s->root_piece_history_index = depth;
+    s->stop_at_spot = 0;
+    geom fill = filled;
+    uint level = 0;
+    for (uint i=0; i<num_pieces; ++i){
+        uint count = 0;
+        if (placed & ((uint64_t)1 << i)){
+            s->piece_placing_history[level++] = i;
+        } else {
+            memcpy(s->candidates[i], s->orientations[i], s->orientation_counts[i] * sizeof(geom));
+            count = filter_orientations(s->candidates[i], s->orientation_counts[i], filled, &fill, s->overlapping);
+            if (count == 0){
+                s->backout = true; // 0 would also look like it's been placed
+            }
+        }
+        s->orientation_counts_history[depth][i] = count;
+    }
+    if (s->backout || (space_will_be_full && !geom_equal(fill, full_space_mask))){
+        s->backout = true;
+        return;
+    }
+    if (track_coverage){
+        search_count_coverage(s, depth);
+    }
+    s->conflict_history[depth] = levels_below(depth);
+    search_choose_cell(s);
+}
+
+bool search_known_dead_end(struct search *s){
+    /*
+    Called after placing a piece (and moving piece_history_index on to the next one), with
+    a transposition table: works out the key of the node we've got to and whether the
+    table has it. If not, notes where the search is for search_remember_dead_end().
+    */
+    uint level = s->piece_history_index;
+    s->placed_key_history[level] = s->placed_key_history[level-1]
+        ^ transposition_piece_key(s->piece_placing_index, s->placed_history[level-1]);
+    uint64_t key = mix64(geom_hash(s->space) ^ s->placed_key_history[level]);
+    ++s->stats.transposition_lookups;
+    if (transpositions_find(key)){
+        ++s->stats.prunes[PRUNE_TRANSPOSITION];
+        s->remember_history[level] = false; // It's already there
+        return true;
+    }
+    s->key_history[level] = key;
+    s->loops_history[level] = s->loop_counter;
+    s->leaves_history[level] = s->leaf_counter;
+    s->remember_history[level] = true;
+    return false;
+}
+
+void search_remember_dead_end(struct search *s){
+    // Called when backing out of a level, with everything under it searched.
+    uint level = s->piece_history_index;
+    if (level < num_pieces && s->remember_history[level] && s->leaf_counter == s->leaves_history[level]
+            && s->loop_counter - s->loops_history[level] >= TRANSPOSITION_MIN_NODES){
+        transpositions_add(s->key_history[level], s->loop_counter - s->loops_history[level], &s->stats);
+    }
+}
+
+uint search_next(struct search *s){
+    /*
+    Carries on searching until all the pieces are placed (SEARCH_SOLUTION), we get to
+    stop_at_depth (SEARCH_FRONTIER), we've done pause_every loops (SEARCH_PAUSED) or
+    we've tried all the permutations (SEARCH_DONE).
+
+    Call again to carry on from there.
+    */
+    while (keep_running) {
+
+        // First, some checks we want to do each loop:
+        SLOW_DOWN();
+
+        // Before counting the loop, as pausing doesn't get anything done:
+        if (s->pause_every && --s->loops_until_pause == 0){
+            s->loops_until_pause = s->pause_every;
+            return SEARCH_PAUSED;
+        }
+
+        if (s->show_progress && print_status){
+            print_status = 0;
+            printf("\nPlaced %u pieces.\n", s->piece_history_index+1);
+            print_colored_pieces_in_space(s->placed_history, s->piece_placing_history, s->piece_history_index, s->piece_colors, num_pieces);
+        }
+
+        ++s->loop_counter;
+        if (s->show_progress && s->loop_counter % 1000000 == 0){
+            clock_t end = clock();
+            double duration = ((double) (end - s->previous)) / CLOCKS_PER_SEC;
+            s->previous = end;
+            printf("%.1f seconds at a rate of %.2f million loops/second (about %.2g%% of the tree searched).\n", duration,
+                ((double)(s->loop_counter-s->previous_loop_counter))/duration/1000000.0, search_progress(s) * 100.0);
+            s->previous_loop_counter = s->loop_counter;
+        }
+
+        // The actual logic. We do one of two things: backup the piece we placed last or place a new piece:
+        if (s->backout){ // The latest placed piece makes it impossible to solve the rest in one way or another.
+            s->backout = false;
+
+            // Trying the next orientation for this same piece.
+            // But wait, have we run out of orientations? If yes, back up to the previous piece.
+            // Doing this in a loop as that piece might also have run out of orientations:
+            // We need to keep backing up until we find a piece with more orientations.
+            //
+            // With backjumping, conflict is the placements that are why the node we're backing
+            // out of went nowhere. Placements that aren't in it are backed out of without trying
+            // their other orientations: whichever they're in, the same ones make it go nowhere.
+            // When a piece runs out of orientations, the placements to blame are those that
+            // took its orientations away, and those to blame for each of the ones tried going
+            // nowhere. Anything else (a spot nothing can fill, a solution...) blames them all.
+            uint64_t conflict = backjump ? s->conflict : levels_below(s->piece_history_index);
+            uint skipped = 0;
+            while (true){
+                // Backup, takout a piece, and try placing it differently.
+
+                if (s->piece_history_index == s->root_piece_history_index){
+                    return SEARCH_DONE;
+                }
+                if (transpositions.entries){
+                    search_remember_dead_end(s);
+                }
+                --s->piece_history_index; // Trying to place the previous piece again
+                uint level = s->piece_history_index;
+                if (!(conflict & ((uint64_t)1 << level))){
+                    ++skipped;
+                    continue; // Jumping back past it
+                }
+                if (skipped){
+                    ++s->stats.backjumps[skipped < MAX_PIECES ? skipped : MAX_PIECES - 1];
+                    skipped = 0;
+                }
+                if (backjump){
+                    s->conflict_history[level] |= conflict & ~((uint64_t)1 << level);
+                }
+                s->orientation_placing = s->orientation_history[s->piece_history_index]; // Starting back at the orientation we successfully placed.
+                s->space = s->space_history[s->piece_history_index]; // Resetting the space to what is was before the previous piece was placed
+                s->piece_placing_index = s->piece_placing_history[s->piece_history_index];
+
+                // Go to the next orientation:
                 // If that was the last orientation, we loop again to backup even more:
-            } while (++orientation_placing >= orientation_counts_history[piece_history_index][piece_placing_index]);
-            // printf("On to piece %u: orientation %u/%u\n", piece_history_index+1, orientation_placing+1, orientation_counts_history[piece_history_index][piece_history_index]);
+                ++s->orientation_placing;
+                if (search_find_candidate(s)){
+                    break;
+                }
+                conflict = backjump ? s->conflict_history[level] | search_eliminated_by(s, s->piece_placing_index, level)
+                    : levels_below(level);
+            }
         } else {
             // Place this piece!
-            geom placing = orientations_history[piece_history_index][piece_placing_index][orientation_placing];
+            uint piece_history_index = s->piece_history_index;
+            geom placing;
+            if (s->cell_index){
+                uint entry = s->cell_index->offsets[s->cell_history[piece_history_index]] + s->orientation_placing;
+                placing = s->cell_index->placements[entry];
+                s->piece_placing_index = s->cell_index->pieces[entry];
+                s->piece_placing_history[piece_history_index] = s->piece_placing_index;
+            } else {
+                placing = s->candidates[s->piece_placing_index][s->orientation_placing];
+            }
             #ifdef VERIFY
-            if (!placing){
-                printf("\nWe're trying to place an empty piece (piece %u, orientation %u)!!! :(. Something went wrong.\n\nExiting.\n", piece_placing_index+1, orientation_placing);
+            if (geom_is_empty(placing)){
+                printf("\nWe're trying to place an empty piece (piece %u, orientation %u)!!! :(. Something went wrong.\n\nExiting.\n", s->piece_placing_index+1, s->orientation_placing);
+                exit(1);
+            }
+            if (geom_overlaps(s->space, placing)){
+                printf("\nWe're about to place a piece (piece %u, orientation %u) into the space overlapping another piece!!! :(. Something wen wrong.\n\nExiting.\n", s->piece_placing_index+1, s->orientation_placing);
                 exit(1);
             }
-            if (space & placing){
-                printf("\nWe're about to place a piece (piece %u, orientation %u) into the space overlapping another piece!!! :(. Something wen wrong.\n\nExiting.\n", piece_placing_index+1, orientation_placing);
-                exit(1);
+            #endif
+
+            s->orientation_history[piece_history_index] = s->orientation_placing; // Keeping track of what orientation we're placing
+            s->space_history[piece_history_index] = s->space; // Keeping track of what the space looked like before we place the piece
+            s->placed_history[piece_history_index] = placing;
+            s->space |= placing; // Putting the piece in the space.
+            ++s->stats.placements_at_depth[piece_history_index];
+
+            #ifndef VERBOSE
+            if (piece_history_index > s->maximum_piece_placing){
+                s->maximum_piece_placing = piece_history_index;
+            #endif
+            #if VERBOSE || SHOW_SOME_PROGRESS
+                printf("Placed piece %u (%u/%u) with orientation %u/%u.\n",
+                    s->piece_placing_index+1,
+                    piece_history_index, num_pieces,
+                    s->orientation_placing+1,
+                    s->orientation_counts_history[piece_history_index][s->piece_placing_index]);
+                print_colored_pieces_in_space(s->placed_history, s->piece_placing_history, piece_history_index, s->piece_colors, num_pieces);
+            #endif
+            #ifndef VERBOSE
+            }
+            #endif
+
+            #ifdef DEBUG_SOLUTION
+            for (uint i=0; i<=piece_history_index; ++i){
+                printf("%u ", s->piece_placing_history[i]);
+            }
+            printf("\n");
+            for (uint i=0; i<=piece_history_index; ++i){
+                if (geom_equal(s->placed_history[i], s->solution[s->piece_placing_history[i]])){
+                    printf("+ ");
+                } else {
+                    printf("  ");
+                }
             }
+            printf("\n");
             #endif
 
-            orientation_history[piece_history_index] = orientation_placing; // Keeping track of what orientation we're placing
-            space_history[piece_history_index] = space; // Keeping track of what the space looked like before we place the piece
-            space |= placing; // Putting the piece in the space.
+            ++s->piece_history_index; // Moving on to the next piece
+            s->orientation_placing = 0; // Starting with the first orientation for the next piece.
+
+            // Now, checking if there's any reason to quit or undo this placement.
+            // Set backout to true if we need to undo this placement and try the next orientation.
+
+            // If we've placed the last piece, we've got a solution. Backing out next time
+            // around in case we're asked to carry on and find more:
+            if (s->piece_history_index == num_pieces){ // Have we placed all the pieces?
+                s->backout = true;
+                if (backjump){
+                    s->conflict = levels_below(s->piece_history_index);
+                }
+                ++s->leaf_counter;
+                return SEARCH_SOLUTION;
+            }
+
+            // Or have we been here before, by placing the same pieces some other way, and
+            // found nothing?
+            if (transpositions.entries && search_known_dead_end(s)){
+                s->backout = true;
+                if (backjump){
+                    s->conflict = levels_below(s->piece_history_index);
+                }
+                continue;
+            }
+
+            search_trim_orientations(s);
+
+            if (!s->backout && (s->piece_history_index == s->stop_at_depth
+                    || (s->stop_at_spot && s->cell_history[s->piece_history_index] >= s->stop_at_spot))){
+                s->backout = true;
+                if (backjump){
+                    s->conflict = levels_below(s->piece_history_index);
+                }
+                ++s->leaf_counter;
+                return SEARCH_FRONTIER;
+            }
+        }
+    }
+    return SEARCH_DONE;
+}
+
+
+/*
+Parallel search: the tree is split into subtrees (tasks) a few pieces down, which
+worker threads take from their own deque, stealing from the top of each other's when
+theirs runs out. Whenever some worker is left with nothing to do, the others split off
+part of the subtree they're in and put it on their deque for it to steal.
+*/
+
+struct task {
+    uint depth; // How many pieces are already placed at the root of the subtree
+    uint pieces[MAX_PIECES];
+    geom placed[MAX_PIECES];
+    uint next; // The piece placed next (or with a cell_index, the spot filled next)
+    uint first;
+    uint last;
+    geom candidates[]; // Orientations of next to try (none with a cell_index, first and last are entries for the spot)
+};
+
+struct task *task_from_search(struct search *s, uint depth, uint first, uint last){
+    /*
+    The subtree of s with the pieces placed before depth, and orientations first through
+    last-1 of the piece placed at depth (or entries of the spot filled at depth).
+    */
+    uint candidate_count = s->cell_index ? 0 : last - first;
+    struct task *t = malloc(sizeof(struct task) + candidate_count * sizeof(geom));
+    t->depth = depth;
+    for (uint i=0; i<depth; ++i){
+        t->pieces[i] = s->piece_placing_history[i];
+        t->placed[i] = s->placed_history[i];
+    }
+    if (s->cell_index){
+        t->next = s->cell_history[depth];
+        t->first = first;
+        t->last = last;
+    } else {
+        t->next = s->piece_placing_history[depth];
+        t->first = 0;
+        t->last = candidate_count;
+        for (uint j=first; j<last; ++j){
+            t->candidates[j - first] = s->candidates[t->next][j];
+        }
+    }
+    return t;
+}
+
+struct task *search_split(struct search *s){
+    /*
+    Gives away the second half of the orientations left to try for the piece placed
+    closest to the root of the subtree s is searching. Returns NULL if there's nothing
+    left to give away.
+    */
+    for (uint depth=s->root_piece_history_index; depth<s->piece_history_index; ++depth){
+        uint *orientation_count = search_candidates_end(s, depth);
+        uint remaining = *orientation_count - (s->orientation_history[depth] + 1);
+        if (remaining > 0){
+            uint first = *orientation_count - (remaining + 1) / 2;
+            struct task *t = task_from_search(s, depth, first, *orientation_count);
+            for (uint i=s->root_piece_history_index; i<=depth; ++i){
+                s->remember_history[i] = false; // They're only partly searched here now
+                s->conflict_history[i] = levels_below(i); // So nothing can be jumped back past them
+            }
+            if (track_coverage && !s->cell_index){
+                // Like search_start_at() does for the piece at the root:
+                s->uncovered_history[depth] |= search_uncover(s->coverage_history[depth],
+                    s->candidates[s->piece_placing_history[depth]] + first, *orientation_count - first);
+            }
+            *orientation_count = first;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+struct task **split_tree(struct search *s, uint depth, uint *task_count){
+    /*
+    The subtrees with depth pieces placed, in the order a serial search gets to them. s has
+    to have been set up with search_start(), and is left having counted the loops and
+    placements above the subtrees.
+    */
+    s->show_progress = false;
+    s->stop_at_depth = depth;
+    struct task **tasks = NULL;
+    uint task_capacity = 0;
+    *task_count = 0;
+    uint result;
+    while ((result = search_next(s)) != SEARCH_DONE){
+        if (result == SEARCH_FRONTIER){
+            if (*task_count == task_capacity){
+                task_capacity = task_capacity ? task_capacity * 2 : 256;
+                tasks = realloc(tasks, task_capacity * sizeof(struct task *));
+            }
+            tasks[(*task_count)++] = task_from_search(s, depth, s->orientation_placing, *search_candidates_end(s, depth));
+        }
+    }
+    return tasks;
+}
+
+void free_tasks(struct task **tasks, uint task_count){
+    for (uint i=0; i<task_count; ++i){
+        free(tasks[i]);
+    }
+    free(tasks);
+}
+
+/*
+Shards: splitting a search between processes (on different machines, say) that don't
+share anything. Each one splits the tree into the same subtrees a few pieces down and
+takes its share of them, so the shards search disjoint parts of the tree which add up to
+all of it. That only works because the split is the same every time: it only depends on
+the puzzle and options (filter_orientations() keeps the same order whichever kernel does
+it).
+
+Subtrees can be very different sizes, so they're shared out by how big they look
+(largest first, each to the shard with the least so far) rather than in turn. How big a
+subtree looks is how many nodes there are in its first couple of levels.
+*/
+
+#define SHARD_SUBTREES_PER_SHARD 32 // Split deep enough for at least this many each
+#define SHARD_ESTIMATE_DEPTH 2 // Levels of each subtree searched to see how big it looks
+
+struct shard {
+    uint index; // From 0
+    uint count;
+    uint depth; // How many pieces down to split the tree. 0 to pick one
+
+    // Filled in by shard_tasks():
+    uint subtree_count; // In the whole tree
+    uint task_count; // This shard's
+    double share; // Of the estimated size of the whole tree
+};
+
+struct subtree_estimate {
+    long unsigned int nodes;
+    uint index;
+};
+
+int compare_subtree_estimates(const void *a, const void *b){
+    // Biggest first, in tree order when they're the same.
+    const struct subtree_estimate *first = a;
+    const struct subtree_estimate *second = b;
+    if (first->nodes != second->nodes){
+        return first->nodes > second->nodes ? -1 : 1;
+    }
+    return first->index < second->index ? -1 : 1;
+}
+
+long unsigned int estimate_subtree(struct task *t, geom **orientations, uint *orientation_counts, char **piece_colors,
+        struct cell_index *cell_index){
+    // How many nodes there are in the top SHARD_ESTIMATE_DEPTH levels of the subtree.
+    struct search *s = calloc(1, sizeof(struct search));
+    search_start(s, orientations, orientation_counts, piece_colors, cell_index);
+    s->show_progress = false;
+    search_start_at(s, t->depth, t->pieces, t->placed, t->next, t->candidates, t->first, t->last);
+    s->stop_at_depth = t->depth + SHARD_ESTIMATE_DEPTH;
+    while (search_next(s) != SEARCH_DONE){
+    }
+    long unsigned int nodes = s->loop_counter;
+    search_free(s);
+    return nodes;
+}
+
+struct task **shard_tasks(struct search *s, struct shard *shard, geom **orientations, uint *orientation_counts,
+        char **piece_colors, struct cell_index *cell_index, uint *task_count){
+    /*
+    Splits the tree into subtrees with search s (like split_tree()) and returns the ones
+    that are this shard's, in tree order.
+    */
+    struct task **tasks = NULL;
+    uint all_count = 0;
+    uint depth = shard->depth ? shard->depth : 1;
+    if (depth >= num_pieces){
+        depth = num_pieces - 1;
+    }
+    for (; depth<num_pieces; ++depth){
+        free_tasks(tasks, all_count);
+        search_start(s, orientations, orientation_counts, piece_colors, cell_index);
+        tasks = split_tree(s, depth, &all_count);
+        if (shard->depth || all_count >= SHARD_SUBTREES_PER_SHARD * shard->count){
+            break;
+        }
+    }
+    shard->depth = depth < num_pieces ? depth : num_pieces - 1;
+    shard->subtree_count = all_count;
+
+    struct subtree_estimate *estimates = malloc((all_count + 1) * sizeof(struct subtree_estimate));
+    for (uint i=0; i<all_count; ++i){
+        estimates[i].nodes = estimate_subtree(tasks[i], orientations, orientation_counts, piece_colors, cell_index);
+        estimates[i].index = i;
+    }
+    qsort(estimates, all_count, sizeof(struct subtree_estimate), compare_subtree_estimates);
+
+    // Largest first to whichever shard has the least so far:
+    long unsigned int *loads = calloc(shard->count, sizeof(long unsigned int));
+    bool *ours = calloc(all_count + 1, sizeof(bool));
+    long unsigned int total = 0;
+    for (uint i=0; i<all_count; ++i){
+        uint least = 0;
+        for (uint j=1; j<shard->count; ++j){
+            if (loads[j] < loads[least]){
+                least = j;
+            }
+        }
+        loads[least] += estimates[i].nodes;
+        total += estimates[i].nodes;
+        ours[estimates[i].index] = least == shard->index;
+    }
+    shard->share = total ? (double)loads[shard->index] / (double)total : 0;
+
+    *task_count = 0;
+    for (uint i=0; i<all_count; ++i){
+        if (ours[i]){
+            tasks[(*task_count)++] = tasks[i];
+        } else {
+            free(tasks[i]);
+        }
+    }
+    shard->task_count = *task_count;
+    free(loads);
+    free(ours);
+    free(estimates);
+    return tasks;
+}
+
+struct deque {
+    // The owner pushes and pops tasks at the bottom, others steal from the top.
+    pthread_mutex_t lock;
+    struct task **tasks;
+    uint capacity;
+    uint top;
+    uint bottom;
+};
+
+void deque_push(struct deque *d, struct task *t){
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom == d->capacity){
+        if (d->top > 0){
+            memmove(d->tasks, d->tasks + d->top, (d->bottom - d->top) * sizeof(struct task *));
+            d->bottom -= d->top;
+            d->top = 0;
+        } else {
+            d->capacity = d->capacity ? d->capacity * 2 : 64;
+            d->tasks = realloc(d->tasks, d->capacity * sizeof(struct task *));
+        }
+    }
+    d->tasks[d->bottom++] = t;
+    pthread_mutex_unlock(&d->lock);
+}
+
+struct task *deque_pop(struct deque *d, bool from_top){
+    struct task *t = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->top < d->bottom){
+        t = from_top ? d->tasks[d->top++] : d->tasks[--d->bottom];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+bool deque_is_empty(struct deque *d){
+    pthread_mutex_lock(&d->lock);
+    bool empty = d->top == d->bottom;
+    pthread_mutex_unlock(&d->lock);
+    return empty;
+}
+
+struct parallel {
+    uint thread_count;
+    struct deque *deques;
+
+    geom **orientations;
+    uint *orientation_counts;
+    char **piece_colors;
+    bool print_solutions;
+    uint solutions_to_print; // Only the first ones found, if print_solutions
+    struct symmetry *symmetry; // NULL if we're not breaking symmetry
+    struct cell_index *cell_index; // NULL to branch on pieces
+
+    // Shared between the workers. Only touched with __atomic builtins:
+    uint outstanding_tasks; // Tasks queued or being searched
+    uint idle_workers;
+    uint running_workers;
+    uint solution_count;
+    long unsigned int symmetric_solution_count;
+    double first_solution_at; // Written by whoever finds the first one
+    uint stop;
+    long unsigned int *loop_counters; // Published by each worker every so often
+
+    pthread_mutex_t print_lock;
+};
+
+struct worker {
+    struct parallel *p;
+    uint id;
+    struct search *s;
+    struct search_stats stats; // Added up over the tasks it's searched
+};
+
+#define WORKER_PAUSE_EVERY 4096 // Loops between checking if anyone needs work
+
+void report_solution(struct parallel *p, struct search *s){
+    uint copy_count = 1;
+    if (p->symmetry){
+        copy_count = symmetric_solutions(p->symmetry, s->placed_history, s->piece_placing_history, NULL);
+        if (copy_count == 0){
+            return;
+        }
+    }
+    #ifdef STOP_AT_FIRST_SOLUTION
+    if (__atomic_exchange_n(&p->stop, 1, __ATOMIC_SEQ_CST)){
+        return; // Someone else beat us to it.
+    }
+    #endif
+    uint solution_count = __atomic_add_fetch(&p->solution_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p->symmetric_solution_count, copy_count, __ATOMIC_RELAXED);
+    if (solution_count == 1){
+        p->first_solution_at = seconds_now();
+    }
+    if (p->print_solutions && solution_count <= p->solutions_to_print){
+        pthread_mutex_lock(&p->print_lock);
+        #ifdef STOP_AT_FIRST_SOLUTION
+        printf("\nStopping at first solution!\n");
+        #else
+        printf("Solution %u:\n", solution_count);
+        #endif
+        print_colored_pieces_in_space(s->placed_history, s->piece_placing_history, num_pieces, p->piece_colors, num_pieces);
+        if (p->symmetry && p->symmetry->expand){
+            print_symmetric_copies(p->symmetry, s->placed_history, s->piece_placing_history, p->piece_colors);
+        }
+        pthread_mutex_unlock(&p->print_lock);
+    }
+}
+
+void *worker_run(void *arg){
+    struct worker *w = arg;
+    struct parallel *p = w->p;
+    struct deque *own = &p->deques[w->id];
+    long unsigned int loop_counter = 0;
+    bool idle = false;
+
+    while (keep_running && !__atomic_load_n(&p->stop, __ATOMIC_RELAXED)){
+        struct task *t = deque_pop(own, false);
+        for (uint i=1; !t && i<p->thread_count; ++i){
+            t = deque_pop(&p->deques[(w->id + i) % p->thread_count], true);
+        }
+        if (!t){
+            if (!idle){
+                idle = true;
+                __atomic_add_fetch(&p->idle_workers, 1, __ATOMIC_SEQ_CST);
+            }
+            if (__atomic_load_n(&p->outstanding_tasks, __ATOMIC_SEQ_CST) == 0){
+                break; // Everything's been searched
+            }
+            sched_yield();
+            continue;
+        }
+        if (idle){
+            idle = false;
+            __atomic_sub_fetch(&p->idle_workers, 1, __ATOMIC_SEQ_CST);
+        }
+
+        struct search *s = w->s;
+        search_start(s, p->orientations, p->orientation_counts, p->piece_colors, p->cell_index);
+        s->show_progress = false;
+        s->pause_every = WORKER_PAUSE_EVERY;
+        s->loops_until_pause = WORKER_PAUSE_EVERY;
+        search_start_at(s, t->depth, t->pieces, t->placed, t->next, t->candidates, t->first, t->last);
+        free(t);
+
+        uint result;
+        while ((result = search_next(s)) != SEARCH_DONE){
+            if (result == SEARCH_SOLUTION){
+                report_solution(p, s);
+            } else if (result == SEARCH_PAUSED){
+                __atomic_store_n(&p->loop_counters[w->id], loop_counter + s->loop_counter, __ATOMIC_RELAXED);
+                if (__atomic_load_n(&p->stop, __ATOMIC_RELAXED)){
+                    break;
+                }
+                if (__atomic_load_n(&p->idle_workers, __ATOMIC_SEQ_CST) > 0 && deque_is_empty(own)){
+                    struct task *donated = search_split(s);
+                    if (donated){
+                        __atomic_add_fetch(&p->outstanding_tasks, 1, __ATOMIC_SEQ_CST);
+                        deque_push(own, donated);
+                    }
+                }
+            }
+        }
+        loop_counter += s->loop_counter;
+        __atomic_store_n(&p->loop_counters[w->id], loop_counter, __ATOMIC_RELAXED);
+        search_stats_add(&w->stats, &s->stats);
+        __atomic_sub_fetch(&p->outstanding_tasks, 1, __ATOMIC_SEQ_CST);
+    }
+    if (idle){
+        __atomic_sub_fetch(&p->idle_workers, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_sub_fetch(&p->running_workers, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+uint solve_in_parallel(uint thread_count, geom **orientations, uint *orientation_counts,
+        char **piece_colors, bool print_solutions, uint solutions_to_print, struct symmetry *symmetry,
+        struct cell_index *cell_index, struct shard *shard, long unsigned int *loop_counter,
+        long unsigned int *symmetric_solution_count, struct search_stats *stats, double *first_solution_at){
+    /*
+    Searches the whole tree (or with a shard, its part of it) using thread_count threads.
+    Returns the number of solutions found, printing the first solutions_to_print of them if
+    print_solutions, and when the first was found (see seconds_now()) in first_solution_at.
+    */
+    struct parallel p = {0};
+    p.thread_count = thread_count;
+    p.orientations = orientations;
+    p.orientation_counts = orientation_counts;
+    p.piece_colors = piece_colors;
+    p.print_solutions = print_solutions;
+    p.solutions_to_print = solutions_to_print;
+    p.symmetry = symmetry;
+    p.cell_index = cell_index;
+    p.deques = calloc(thread_count, sizeof(struct deque));
+    p.loop_counters = calloc(thread_count, sizeof(long unsigned int));
+    pthread_mutex_init(&p.print_lock, NULL);
+    for (uint i=0; i<thread_count; ++i){
+        pthread_mutex_init(&p.deques[i].lock, NULL);
+    }
+
+    // Splitting the tree up into subtrees, going deeper until there's a few for each thread
+    // (or taking this shard's share of them):
+    struct search *s = calloc(1, sizeof(struct search));
+    struct task **tasks = NULL;
+    uint task_count = 0;
+    if (shard){
+        tasks = shard_tasks(s, shard, orientations, orientation_counts, piece_colors, cell_index, &task_count);
+    } else {
+        for (uint depth=1; depth<num_pieces; ++depth){
+            free_tasks(tasks, task_count);
+            search_start(s, orientations, orientation_counts, piece_colors, cell_index);
+            tasks = split_tree(s, depth, &task_count);
+            if (task_count >= 8 * thread_count){
+                break;
+            }
+        }
+    }
+    p.outstanding_tasks = task_count;
+    for (uint i=0; i<task_count; ++i){
+        deque_push(&p.deques[i % thread_count], tasks[i]);
+    }
+    free(tasks);
+    // The workers count what's below the subtrees' roots. With shards, the first one counts
+    // what's above them, so adding up the shards' counts gives the whole tree's:
+    *loop_counter = 0;
+    memset(stats, 0, sizeof(*stats));
+    if (!shard || shard->index == 0){
+        *loop_counter = s->loop_counter;
+        *stats = s->stats;
+    }
+    search_free(s);
+
+    struct worker *workers = calloc(thread_count, sizeof(struct worker));
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    p.running_workers = thread_count;
+    for (uint i=0; i<thread_count; ++i){
+        workers[i].p = &p;
+        workers[i].id = i;
+        workers[i].s = calloc(1, sizeof(struct search));
+        pthread_create(&threads[i], NULL, worker_run, &workers[i]);
+    }
+
+    // Keeping an eye on things while the workers work:
+    struct timespec wait = {0, 10000000};
+    double previous = seconds_now();
+    long unsigned int previous_loop_counter = 0;
+    while (__atomic_load_n(&p.running_workers, __ATOMIC_SEQ_CST) > 0){
+        nanosleep(&wait, NULL);
+        double now = seconds_now();
+        if (print_solutions && now - previous >= 10.0){
+            long unsigned int loops = 0;
+            for (uint i=0; i<thread_count; ++i){
+                loops += __atomic_load_n(&p.loop_counters[i], __ATOMIC_RELAXED);
+            }
+            pthread_mutex_lock(&p.print_lock);
+            printf("%.1f seconds at a rate of %.2f million loops/second (%u subtrees left).\n", now - previous,
+                ((double)(loops-previous_loop_counter))/(now - previous)/1000000.0, __atomic_load_n(&p.outstanding_tasks, __ATOMIC_RELAXED));
+            pthread_mutex_unlock(&p.print_lock);
+            previous = now;
+            previous_loop_counter = loops;
+        }
+    }
+
+    for (uint i=0; i<thread_count; ++i){
+        pthread_join(threads[i], NULL);
+        search_free(workers[i].s);
+        *loop_counter += p.loop_counters[i];
+        search_stats_add(stats, &workers[i].stats);
+        pthread_mutex_destroy(&p.deques[i].lock);
+        // Anything left here is from being interupted or stopping at the first solution:
+        while (p.deques[i].top < p.deques[i].bottom){
+            free(p.deques[i].tasks[p.deques[i].top++]);
+        }
+        free(p.deques[i].tasks);
+    }
+    pthread_mutex_destroy(&p.print_lock);
+    free(threads);
+    free(workers);
+    free(p.deques);
+    free(p.loop_counters);
+    *symmetric_solution_count = p.symmetric_solution_count;
+    *first_solution_at = p.first_solution_at;
+    return p.solution_count;
+}
+
+void print_speedup_curve(geom **orientations, uint *orientation_counts, char **piece_colors,
+        struct symmetry *symmetry, struct cell_index *cell_index){
+    /*
+    Searches the whole tree with 1, 2, 4, ... threads, up to the number of cores, and
+    prints how much faster each is than using one thread.
+    */
+    uint core_count = (uint)sysconf(_SC_NPROCESSORS_ONLN);
+    double one_thread_duration = 0;
+    printf("\nthreads,seconds,solutions,million_loops_per_second,speedup,efficiency\n");
+    for (uint thread_count=1; keep_running; thread_count=(thread_count*2 > core_count) ? core_count : thread_count*2){
+        long unsigned int loop_counter = 0;
+        long unsigned int symmetric_solution_count = 0;
+        struct search_stats stats;
+        double first_solution_at;
+        double start = seconds_now();
+        uint solution_count = solve_in_parallel(thread_count, orientations, orientation_counts, piece_colors, false, 0, symmetry,
+            cell_index, NULL, &loop_counter, &symmetric_solution_count, &stats, &first_solution_at);
+        double duration = seconds_now() - start;
+        if (thread_count == 1){
+            one_thread_duration = duration;
+        }
+        printf("%u,%.3f,%u,%.2f,%.2f,%.2f\n", thread_count, duration, solution_count, (double)loop_counter/duration/1000000.0,
+            one_thread_duration/duration, one_thread_duration/duration/thread_count);
+        fflush(stdout);
+
+        if (thread_count >= core_count){
+            break;
+        }
+    }
+}
+
+
+/*
+Meet in the middle (--engine=mitm): splits the box at a spot (--cut, half way by default)
+and counts the solutions one half at a time. Filling the spots in order (branching on
+cells), the pieces placed by the time every spot before the cut is filled are the ones
+whose lowest spot is before it. Whatever the ways they were placed, all that matters to
+the rest of the search is which pieces they were and which spots after the cut they stick
+out into (the boundary). So every way of filling the lower half is found first, and
+counted up in an index by boundary and pieces. Then the rest of the box is searched once
+from each of those, and each count of ways to fill the upper half is multiplied by the
+number of ways there were to get there.
+
+That trades the index's memory for searching the upper half again for every way of
+filling the lower half that ends up the same. It only counts the solutions.
+*/
+
+struct half_filling {
+    geom boundary; // The spots after the cut filled
+    uint64_t pieces; // A bit for each piece placed
+    long unsigned int count; // How many ways there are to get here. 0 for an empty entry
+};
+
+struct filling_index {
+    // A hash table of half_fillings, by boundary and pieces.
+    struct half_filling *entries;
+    size_t capacity; // A power of 2
+    size_t count;
+};
+
+static inline size_t filling_index_slot(struct filling_index *index, geom boundary, uint64_t pieces){
+    return (size_t)(geom_hash(boundary) ^ mix64(pieces)) & (index->capacity - 1);
+}
+
+void filling_index_add(struct filling_index *index, geom boundary, uint64_t pieces, long unsigned int count){
+    if (2 * (index->count + 1) > index->capacity){
+        // Keeping it at most half full:
+        struct filling_index bigger = {calloc(index->capacity ? 2 * index->capacity : 1024, sizeof(struct half_filling)),
+            index->capacity ? 2 * index->capacity : 1024, 0};
+        for (size_t i=0; i<index->capacity; ++i){
+            if (index->entries[i].count){
+                filling_index_add(&bigger, index->entries[i].boundary, index->entries[i].pieces, index->entries[i].count);
+            }
+        }
+        free(index->entries);
+        *index = bigger;
+    }
+    size_t slot = filling_index_slot(index, boundary, pieces);
+    while (index->entries[slot].count && !(index->entries[slot].pieces == pieces && geom_equal(index->entries[slot].boundary, boundary))){
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    struct half_filling *entry = &index->entries[slot];
+    if (!entry->count){
+        entry->boundary = boundary;
+        entry->pieces = pieces;
+        ++index->count;
+    }
+    entry->count += count;
+}
+
+#define MITM_PROGRESS_EVERY 10000000 // Lower half loops between progress lines when verbose
+
+uint solve_meet_in_the_middle(geom **orientations, uint *orientation_counts, char **piece_colors,
+        struct cell_index *cell_index, uint cut, bool verbose, long unsigned int *loop_counter,
+        struct search_stats *stats, double *first_solution_at, bool *finished){
+    /*
+    Counts the solutions, splitting the box before spot cut (see above). Returns how many
+    there are (up to UINT_MAX: the exact number's printed if verbose), the nodes visited
+    by both halves in loop_counter and when the first was found (see seconds_now()) in
+    first_solution_at. finished says whether it got to the end.
+    */
+    geom lower = GEOM_EMPTY;
+    for (uint spot=0; spot<cut; ++spot){
+        lower |= geom_bit(spot);
+    }
+
+    // Every way of filling the lower half:
+    struct search *s = calloc(1, sizeof(struct search));
+    search_start(s, orientations, orientation_counts, piece_colors, cell_index);
+    s->show_progress = false;
+    s->stop_at_spot = cut;
+    if (verbose){
+        s->pause_every = MITM_PROGRESS_EVERY;
+        s->loops_until_pause = MITM_PROGRESS_EVERY;
+    }
+    struct filling_index index = {NULL, 0, 0};
+    long unsigned int lower_count = 0;
+    long unsigned int solution_count = 0;
+    uint result;
+    while ((result = search_next(s)) != SEARCH_DONE){
+        if (result == SEARCH_PAUSED){
+            printf("Filled the first %u spots %lu ways so far in %lu nodes, %zu different boundaries and pieces (%.1f MB of index).\n",
+                cut, lower_count, s->loop_counter, index.count, (double)(index.capacity * sizeof(struct half_filling)) / (1 << 20));
+            fflush(stdout);
+            continue;
+        }
+        if (result == SEARCH_SOLUTION){
+            if (++solution_count == 1){ // Filled the whole box without getting past the cut
+                *first_solution_at = seconds_now();
+            }
+            continue;
+        }
+        uint64_t pieces = 0;
+        for (uint i=0; i<s->piece_history_index; ++i){
+            pieces |= (uint64_t)1 << s->piece_placing_history[i];
+        }
+        filling_index_add(&index, s->space & ~lower, pieces, 1);
+        ++lower_count;
+    }
+    *loop_counter = s->loop_counter;
+    *stats = s->stats;
+    bool lower_done = keep_running;
+    if (verbose && !lower_done){
+        printf("Stopped filling the first %u spots after %lu ways (%.1f MB of index), before searching the rest of the box.\n",
+            cut, lower_count, (double)(index.capacity * sizeof(struct half_filling)) / (1 << 20));
+    } else if (verbose){
+        printf("Filled the first %u spots %lu ways, leaving %zu different boundaries and pieces (%.1f MB of index).\n",
+            cut, lower_count, index.count, (double)(index.capacity * sizeof(struct half_filling)) / (1 << 20));
+    }
+
+    // The rest of the box, from each of those:
+    search_start(s, orientations, orientation_counts, piece_colors, cell_index);
+    s->show_progress = false;
+    for (size_t i=0; i<index.capacity && keep_running; ++i){
+        struct half_filling *entry = &index.entries[i];
+        if (!entry->count){
+            continue;
+        }
+        search_start_filled(s, lower | entry->boundary, entry->pieces);
+        long unsigned int upper_count = 0;
+        while (search_next(s) == SEARCH_SOLUTION){
+            ++upper_count;
+        }
+        if (upper_count && !solution_count){
+            *first_solution_at = seconds_now();
+        }
+        solution_count += entry->count * upper_count;
+    }
+    *loop_counter += s->loop_counter;
+    search_stats_add(stats, &s->stats);
+    *finished = keep_running;
+    if (verbose && lower_done){
+        printf("%s the rest of the box from each of them (%lu nodes), for %lu solutions.\n",
+            *finished ? "Searched" : "Stopped part way through searching", s->loop_counter, solution_count);
+    }
+
+    free(index.entries);
+    search_free(s);
+    return solution_count < UINT_MAX ? (uint)solution_count : UINT_MAX;
+}
+
+/*
+Counting by frontier (--engine=frontier): dynamic programming over the spots in order,
+never finding the solutions one by one. Once every spot before some spot is filled, what's
+left to do only depends on the spots from there on that are already filled (by pieces
+sticking out past it) and which pieces have been used, as in meet in the middle. Each of
+those states is kept in a filling_index with how many ways there are to get to it. Moving
+on a spot, the states with it filled carry over as they are and the others branch into
+one state for each remaining piece that can go with its lowest spot there. After the last
+spot, the one state left (nothing filled past the end, every piece used) has the count.
+
+Its time and memory go with how many states there are at once rather than the number of
+solutions, which helps puzzles with lots of solutions. There's no pruning, so states that
+go nowhere are carried along until nothing fits their next empty spot.
+*/
+
+bool leaves_small_hole(geom space, geom placement){
+    /*
+    Whether placing placement in space (where it's already been put) boxes in some hole
+    next to it that's too small for any piece, growing each one until it's big enough.
+    */
+    geom holes = ~space & full_space_mask;
+    geom around = grow_into_neighbours(placement) & holes;
+    while (!geom_is_empty(around)){
+        geom hole = geom_lowest(around);
+        while (geom_popcount(hole) < common_piece_size){
+            geom grown = grow_into_neighbours(hole) & holes;
+            if (geom_equal(grown, hole)){
+                return true;
+            }
+            hole = grown;
+        }
+        around &= ~hole;
+    }
+    return false;
+}
+
+void filling_index_clear(struct filling_index *index){
+    memset(index->entries, 0, index->capacity * sizeof(struct half_filling));
+    index->count = 0;
+}
+
+uint count_by_frontier(struct cell_index *cell_index, bool verbose, long unsigned int *loop_counter,
+        struct search_stats *stats, bool *finished){
+    /*
+    Counts the solutions, with the cell_index for the orientations (see above). Returns
+    how many there are (up to UINT_MAX: the exact number's printed if verbose), with the
+    placements tried in loop_counter. finished says whether it got to the end.
+    */
+    struct filling_index states = {NULL, 0, 0};
+    struct filling_index next = {NULL, 0, 0};
+    filling_index_add(&states, GEOM_EMPTY, 0, 1);
+    size_t most_states = 1;
+    size_t most_memory = 0;
+    *loop_counter = 0;
+    geom done = GEOM_EMPTY; // The spots up to this one
+    for (uint spot=0; spot<space_size && keep_running; ++spot){
+        geom filling = geom_bit(spot);
+        done |= filling;
+        for (size_t i=0; i<states.capacity; ++i){
+            struct half_filling *state = &states.entries[i];
+            if (!state->count){
+                continue;
+            }
+            if (geom_overlaps(state->boundary, filling)){
+                filling_index_add(&next, state->boundary & ~filling, state->pieces, state->count);
+                continue;
+            }
+            uint depth = (uint)__builtin_popcountll(state->pieces);
+            geom filled = state->boundary | done;
+            uint first = cell_index->offsets[spot];
+            for (uint entry=first; entry<first+cell_index->first_counts[spot]; ++entry){
+                uint piece = cell_index->pieces[entry];
+                geom placement = cell_index->placements[entry];
+                // The copies of a piece go in order of their lowest spot (see search_find_candidate()):
+                if (state->pieces & ((uint64_t)1 << piece) || geom_overlaps(state->boundary, placement)
+                        || (piece > 0 && piece_groups[piece-1] == piece_groups[piece] && !(state->pieces & ((uint64_t)1 << (piece-1))))){
+                    continue;
+                }
+                ++*loop_counter;
+                ++stats->placements_at_depth[depth];
+                if (leaves_small_hole(filled | placement, placement)){
+                    ++stats->prunes[PRUNE_HOLE_SIZES];
+                    continue;
+                }
+                filling_index_add(&next, (state->boundary | placement) & ~filling, state->pieces | ((uint64_t)1 << piece),
+                    state->count);
+            }
+        }
+        struct filling_index swap = states;
+        states = next;
+        next = swap;
+        filling_index_clear(&next);
+        if (states.count > most_states){
+            most_states = states.count;
+        }
+        size_t memory = (states.capacity + next.capacity) * sizeof(struct half_filling);
+        if (memory > most_memory){
+            most_memory = memory;
+        }
+    }
+    *finished = keep_running;
+
+    long unsigned int solution_count = 0;
+    for (size_t i=0; i<states.capacity; ++i){
+        if (states.entries[i].count && states.entries[i].pieces == ((uint64_t)-1 >> (64 - num_pieces))){
+            solution_count += states.entries[i].count;
+        }
+    }
+    if (verbose){
+        printf("Counted through %u spots with up to %zu states at once (%.1f MB), for %lu solutions.\n",
+            space_size, most_states, (double)most_memory / (1 << 20), solution_count);
+    }
+    free(states.entries);
+    free(next.entries);
+    return solution_count < UINT_MAX ? (uint)solution_count : UINT_MAX;
+}
+
+void print_filter_benchmark(geom **orientations, uint *orientation_counts){
+    /*
+    Times each filter kernel the CPU supports on the real orientations, against spaces
+    part filled with randomly placed pieces like the search sees, and prints how many
+    orientations each tests per nanosecond, as CSV.
+    */
+    #define FILTER_BENCHMARK_SPACES 256
+    geom spaces[FILTER_BENCHMARK_SPACES];
+    uint64_t random_state = 88172645463325252ull;
+    for (uint i=0; i<FILTER_BENCHMARK_SPACES; ++i){
+        spaces[i] = GEOM_EMPTY;
+        for (uint attempt=0; attempt<i%num_pieces; ++attempt){
+            random_state ^= random_state << 13;
+            random_state ^= random_state >> 7;
+            random_state ^= random_state << 17;
+            uint piece = (uint)(random_state % num_pieces);
+            geom orientation = orientations[piece][(random_state >> 32) % orientation_counts[piece]];
+            if (!geom_overlaps(spaces[i], orientation)){
+                spaces[i] |= orientation;
+            }
+        }
+    }
+
+    uint total_orientation_count = 0;
+    uint most_orientations = 0;
+    for (uint i=0; i<num_pieces; ++i){
+        total_orientation_count += orientation_counts[i];
+        if (orientation_counts[i] > most_orientations){
+            most_orientations = orientation_counts[i];
+        }
+    }
+    // The kernels only move the orientations around, so they can be run over and over on these:
+    geom *working[MAX_PIECES];
+    working[0] = malloc(total_orientation_count * sizeof(geom));
+    for (uint i=0; i<num_pieces; ++i){
+        if (i > 0){
+            working[i] = working[i - 1] + orientation_counts[i - 1];
+        }
+        memcpy(working[i], orientations[i], orientation_counts[i] * sizeof(geom));
+    }
+    geom *overlapping = malloc(most_orientations * sizeof(geom));
+
+    struct filter_kernel_option kernels[3];
+    uint kernel_count = available_filter_kernels(kernels);
+    printf("\nkernel,orientations_per_nanosecond,kept\n");
+    for (uint k=0; k<kernel_count; ++k){
+        uint rounds = 0;
+        long unsigned int kept = 0;
+        geom fill = GEOM_EMPTY;
+        double start = seconds_now();
+        double duration;
+        do {
+            for (uint i=0; i<FILTER_BENCHMARK_SPACES; ++i){
+                for (uint piece=0; piece<num_pieces; ++piece){
+                    kept += kernels[k].kernel(working[piece], orientation_counts[piece], spaces[i], &fill, overlapping);
+                }
+            }
+            ++rounds;
+            duration = seconds_now() - start;
+        } while (duration < 1.0 && keep_running);
+        double tested = (double)rounds * FILTER_BENCHMARK_SPACES * total_orientation_count;
+        printf("%s,%.3f,%.3f\n", kernels[k].name, tested / duration / 1e9, (double)kept / tested);
+        fflush(stdout);
+    }
+    free(working[0]);
+    free(overlapping);
+}
+
+
+#define ENGINE_MRV 0 // Branch on the piece with the fewest orientations left (search_next())
+#define ENGINE_DLX 1 // Branch on the piece or spot with the fewest options left (solve_with_dlx())
+#define ENGINE_MITM 2 // Count the ways to fill each half of the box (solve_meet_in_the_middle())
+#define ENGINE_FRONTIER 3 // Count the ways to fill the box spot by spot (count_by_frontier())
+
+const char *engine_names[] = {"mrv", "dlx", "mitm", "frontier"};
+
+struct options {
+    uint engine;
+    uint thread_count; // 0 to search on this thread, without splitting up the tree
+    bool speedup;
+    bool benchmark_filter;
+    bool break_symmetry;
+    bool expand_symmetry;
+    bool branch_on_cells; // Fill the lowest empty spot next rather than placing the piece with the fewest orientations
+    bool batch; // Only print a line of CSV per puzzle
+    bool mirrors; // Pieces can be flipped over into their mirror images too
+    bool coverage; // Count what covers each spot as the default engine goes (see track_coverage)
+    uint cut; // Where --engine=mitm splits the box: the number of spots in the lower half. 0 for half way
+    uint transposition_megabytes; // How big a transposition table the default engine gets. 0 for none
+    bool forced; // Place the only orientation that can fill some spot first (see force_spots). On by default
+    bool backjump; // Back out past placements that aren't to blame (see backjump)
+    bool hole_sums; // Check holes against sums of the sizes of the pieces left, when they differ (see check_hole_sums)
+    bool count_only; // Count the solutions, printing how many pieces were placed at each depth rather than each solution
+    uint solutions_to_print; // The first ones, with count_only
+    char *checkpoint_path; // Where to save (and resume from) checkpoints. NULL for none
+    struct shard shard; // Which part of the tree to search. A count of 0 for all of it
+    long unsigned int max_nodes; // Stop after visiting about this many. 0 for no limit
+    uint benchmark_runs; // Time each puzzle this many times (see run_benchmark()). 0 to just solve them
+    FILE *stats_file; // Where to print a line of JSON per puzzle with its solve_stats. NULL for nowhere
+};
+
+struct solve_stats {
+    // How solving a puzzle went, for run_benchmark() and --stats.
+    uint solution_count;
+    long unsigned int symmetric_solution_count;
+    long unsigned int nodes;
+    double seconds; // Including setting up the orientations
+    double first_solution_seconds; // Since the start too. Negative if none were found
+    bool finished; // Searched the whole tree, rather than stopping at max_nodes or being interupted
+
+    // Where the time went:
+    double orientation_seconds; // populate_orientations()
+    double symmetry_seconds; // symmetry_init()
+    double index_seconds; // cell_index_init()
+    double search_seconds;
+
+    struct search_stats search;
+};
 
-            #ifndef VERBOSE
-            if (piece_history_index > maximum_piece_placing){
-                maximum_piece_placing = piece_history_index;
-            #endif
-            #if VERBOSE || SHOW_SOME_PROGRESS
-                printf("Placed piece %u (%u/%u) with orientation %u/%u.\n",
-                    piece_placing_index+1,
-                    piece_history_index, NUM_PIECES,
-                    orientation_placing+1,
-                    orientation_counts_history[piece_history_index-1][piece_placing_index]);
-                print_colored_pieces_in_space(orientations_history, orientation_history, piece_placing_history, piece_history_index);
-            #endif
-            #ifndef VERBOSE
-            }
-            #endif
+void print_solve_stats_json(FILE *file, char *puzzle_name, struct options *options, struct solve_stats *stats){
+    // As a line of JSON.
+    fprintf(file, "{\"puzzle\": ");
+    print_json_string(file, puzzle_name);
+    fprintf(file, ", \"engine\": \"%s\", \"branch\": \"%s\", \"threads\": %u, \"finished\": %s, ",
+        engine_names[options->engine], options->engine >= ENGINE_MITM || (options->engine == ENGINE_MRV && options->branch_on_cells) ? "cell" : "piece",
+        options->thread_count > 0 ? options->thread_count : 1, stats->finished ? "true" : "false");
+    fprintf(file, "\"solutions\": %u, \"symmetric_solutions\": %lu, \"nodes\": %lu, ",
+        stats->solution_count, stats->symmetric_solution_count, stats->nodes);
+    if (stats->first_solution_seconds >= 0){
+        fprintf(file, "\"first_solution_seconds\": %.6f, ", stats->first_solution_seconds);
+    } else {
+        fprintf(file, "\"first_solution_seconds\": null, ");
+    }
+    fprintf(file, "\"seconds\": {\"orientations\": %.6f, \"symmetry\": %.6f, \"index\": %.6f, \"search\": %.6f, \"total\": %.6f}, ",
+        stats->orientation_seconds, stats->symmetry_seconds, stats->index_seconds, stats->search_seconds, stats->seconds);
+    print_search_stats_json(file, &stats->search);
+    fprintf(file, "}\n");
+    fflush(file);
+}
 
-            #ifdef DEBUG_SOLUTION
-            for (uint i=0; i<=piece_history_index; ++i){
-                printf("%u ", piece_placing_history[i]);
+struct workspace {
+    // What solving a puzzle allocates, kept for the next one so a batch of puzzles doesn't
+    // keep allocating the same things over again.
+    geom *orientation_scratch; // For populate_orientations()
+    geom *orientation_store;
+    uint orientation_store_size;
+    geom *orientations[MAX_PIECES]; // Pointing into orientation_store
+    uint orientation_counts[MAX_PIECES];
+    struct symmetry symmetry;
+    struct cell_index cell_index;
+    struct search *search;
+};
+
+void workspace_free(struct workspace *w){
+    free(w->orientation_scratch);
+    free(w->orientation_store);
+    cell_index_free(&w->cell_index);
+    if (w->search){
+        search_free(w->search);
+    }
+}
+
+/*
+Checkpoints: everything a serial search needs to carry on where it left off, so a long
+run can be interupted (or the machine can go down) and be resumed later. The candidate
+orientations are saved as they are, already trimmed down level by level, so resuming
+doesn't have to place the pieces again to get them back.
+
+A checkpoint is written to a temporary file first and then renamed over the last one, so
+there's always a whole one to resume from.
+*/
+
+#define CHECKPOINT_MAGIC "3dpack07"
+#define CHECKPOINT_EVERY 60.0 // Seconds between checkpoints
+#define CHECKPOINT_PAUSE_EVERY 65536 // Loops between checking if it's time for one
+
+#define CHECKPOINT_NONE 0 // No checkpoint to resume from
+#define CHECKPOINT_RESUMED 1
+#define CHECKPOINT_INVALID 2 // Unreadable, or from another puzzle or build
+
+struct checkpoint {
+    char magic[8];
+    uint geom_bits;
+    uint num_pieces;
+    uint candidate_count; // How many geoms of candidate_store follow
+    uint64_t tree_hash; // Of what's being searched (see hash_search_tree())
+
+    uint solution_count;
+    long unsigned int symmetric_solution_count;
+    long unsigned int loop_counter;
+    struct search_stats stats;
+
+    geom space;
+    bool backout;
+    uint piece_history_index;
+    uint piece_placing_index;
+    uint orientation_placing;
+    uint orientation_history[MAX_PIECES];
+    uint piece_placing_history[MAX_PIECES];
+    geom space_history[MAX_PIECES];
+    geom placed_history[MAX_PIECES];
+    uint cell_history[MAX_PIECES];
+    uint cell_candidates_end[MAX_PIECES];
+    uint orientation_counts_history[MAX_PIECES][MAX_PIECES];
+};
+
+uint64_t hash_bytes(uint64_t hash, const void *bytes, size_t length){
+    // FNV-1a. Start with 14695981039346656037.
+    for (size_t i=0; i<length; ++i){
+        hash = (hash ^ ((const unsigned char *)bytes)[i]) * 1099511628211u;
+    }
+    return hash;
+}
+
+uint64_t hash_search_tree(struct search *s){
+    // Changes with the puzzle, the orientations left after breaking symmetry and how we branch
+    // (forcing spots or not).
+    uint64_t hash = 14695981039346656037u;
+    bool by_cell = s->cell_index != NULL;
+    hash = hash_bytes(hash, &by_cell, sizeof(by_cell));
+    hash = hash_bytes(hash, &force_spots, sizeof(force_spots));
+    uint dimensions[3] = {space_width, space_height, space_depth};
+    hash = hash_bytes(hash, dimensions, sizeof(dimensions));
+    for (uint i=0; i<num_pieces; ++i){
+        hash = hash_bytes(hash, &s->orientation_counts[i], sizeof(uint));
+        hash = hash_bytes(hash, s->orientations[i], s->orientation_counts[i] * sizeof(geom));
+    }
+    return hash;
+}
+
+uint search_candidate_count(struct search *s){
+    uint count = 0;
+    for (uint i=0; i<num_pieces; ++i){
+        count += s->orientation_counts[i];
+    }
+    return count;
+}
+
+bool checkpoint_save(const char *path, struct search *s, uint solution_count, long unsigned int symmetric_solution_count){
+    /*
+    Saves where s has got to (it has to be between calls to search_next()) along with the
+    solutions found so far. Returns false if it couldn't be written.
+    */
+    static struct checkpoint c; // Too big for the stack with lots of pieces
+    memset(&c, 0, sizeof(c));
+    memcpy(c.magic, CHECKPOINT_MAGIC, sizeof(c.magic));
+    c.geom_bits = GEOM_BITS;
+    c.num_pieces = num_pieces;
+    c.candidate_count = search_candidate_count(s);
+    c.tree_hash = hash_search_tree(s);
+
+    c.solution_count = solution_count;
+    c.symmetric_solution_count = symmetric_solution_count;
+    c.loop_counter = s->loop_counter;
+    c.stats = s->stats;
+
+    c.space = s->space;
+    c.backout = s->backout;
+    c.piece_history_index = s->piece_history_index;
+    c.piece_placing_index = s->piece_placing_index;
+    c.orientation_placing = s->orientation_placing;
+    memcpy(c.orientation_history, s->orientation_history, sizeof(c.orientation_history));
+    memcpy(c.piece_placing_history, s->piece_placing_history, sizeof(c.piece_placing_history));
+    memcpy(c.space_history, s->space_history, sizeof(c.space_history));
+    memcpy(c.placed_history, s->placed_history, sizeof(c.placed_history));
+    memcpy(c.cell_history, s->cell_history, sizeof(c.cell_history));
+    memcpy(c.cell_candidates_end, s->cell_candidates_end, sizeof(c.cell_candidates_end));
+    memcpy(c.orientation_counts_history, s->orientation_counts_history, sizeof(c.orientation_counts_history));
+
+    char temporary_path[4096];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+    FILE *file = fopen(temporary_path, "wb");
+    if (!file){
+        printf("Can't write checkpoint file %s.\n", temporary_path);
+        return false;
+    }
+    bool ok = fwrite(&c, sizeof(c), 1, file) == 1
+        && fwrite(s->candidate_store, sizeof(geom), c.candidate_count, file) == c.candidate_count
+        && fflush(file) == 0
+        && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary_path, path) != 0){
+        printf("Failed writing checkpoint file %s.\n", path);
+        remove(temporary_path);
+        return false;
+    }
+    return true;
+}
+
+uint checkpoint_load(const char *path, struct search *s, uint *solution_count, long unsigned int *symmetric_solution_count){
+    /*
+    Puts s back where it was when the checkpoint at path was saved, if there is one. s has
+    to have been set up with search_start() for the same puzzle and options.
+    */
+    FILE *file = fopen(path, "rb");
+    if (!file){
+        return CHECKPOINT_NONE;
+    }
+    static struct checkpoint c;
+    bool ok = fread(&c, sizeof(c), 1, file) == 1
+        && memcmp(c.magic, CHECKPOINT_MAGIC, sizeof(c.magic)) == 0
+        && c.geom_bits == GEOM_BITS
+        && c.num_pieces == num_pieces
+        && c.candidate_count == search_candidate_count(s)
+        && c.tree_hash == hash_search_tree(s)
+        && fread(s->candidate_store, sizeof(geom), c.candidate_count, file) == c.candidate_count;
+    fclose(file);
+    if (!ok){
+        printf("Checkpoint file %s isn't from this puzzle (with these options) and this build.\n", path);
+        return CHECKPOINT_INVALID;
+    }
+
+    *solution_count = c.solution_count;
+    *symmetric_solution_count = c.symmetric_solution_count;
+    s->loop_counter = c.loop_counter;
+    s->previous_loop_counter = c.loop_counter;
+    s->stats = c.stats;
+
+    s->space = c.space;
+    s->backout = c.backout;
+    s->piece_history_index = c.piece_history_index;
+    s->piece_placing_index = c.piece_placing_index;
+    s->orientation_placing = c.orientation_placing;
+    memcpy(s->orientation_history, c.orientation_history, sizeof(c.orientation_history));
+    memcpy(s->piece_placing_history, c.piece_placing_history, sizeof(c.piece_placing_history));
+    memcpy(s->space_history, c.space_history, sizeof(c.space_history));
+    memcpy(s->placed_history, c.placed_history, sizeof(c.placed_history));
+    memcpy(s->cell_history, c.cell_history, sizeof(c.cell_history));
+    memcpy(s->cell_candidates_end, c.cell_candidates_end, sizeof(c.cell_candidates_end));
+    memcpy(s->orientation_counts_history, c.orientation_counts_history, sizeof(c.orientation_counts_history));
+    if (track_coverage){
+        for (uint i=0; i<=s->piece_history_index; ++i){
+            search_count_coverage(s, i);
+        }
+    }
+    for (uint i=0; i<s->piece_history_index && i+1<MAX_PIECES; ++i){
+        s->placed_key_history[i+1] = s->placed_key_history[i]
+            ^ transposition_piece_key(s->piece_placing_history[i], s->placed_history[i]);
+    }
+    // What was to blame for what's been searched isn't saved, so it's all to blame:
+    for (uint i=0; i<=s->piece_history_index && i<MAX_PIECES; ++i){
+        s->conflict_history[i] = levels_below(i);
+    }
+    s->conflict = levels_below(s->piece_history_index);
+    return CHECKPOINT_RESUMED;
+}
+
+uint solve_serially(struct search *search, struct symmetry *symmetry, bool print_solutions,
+        uint solutions_to_print, const char *checkpoint_path, long unsigned int max_nodes, FILE *stats_file,
+        uint solution_count, long unsigned int *symmetric_solution_count, double *first_solution_at, bool *finished){
+    /*
+    Searches the rest of the tree from where search_start() (or checkpoint_load()) left
+    search, carrying on from solution_count solutions (and *symmetric_solution_count)
+    found so far. Returns the number of solutions found, printing the first
+    solutions_to_print of them if print_solutions, and when the first was found (see
+    seconds_now()) in first_solution_at. finished says whether it got to the end of the
+    tree.
+
+    With a checkpoint_path, saves a checkpoint there every so often, when asked to with
+    SIGUSR1 and when interupted, and removes it once the whole tree's been searched.
+
+    With max_nodes, stops soon after visiting that many nodes (at the same point every time).
+
+    With a stats_file, prints a line of JSON with the search's stats so far to it when
+    asked to with SIGUSR1.
+    */
+    if (checkpoint_path || max_nodes || stats_file){
+        search->pause_every = CHECKPOINT_PAUSE_EVERY;
+        search->loops_until_pause = CHECKPOINT_PAUSE_EVERY;
+    }
+    double previous_checkpoint = seconds_now();
+    uint result;
+    while ((result = search_next(search)) != SEARCH_DONE){
+        if (result == SEARCH_PAUSED){
+            if (max_nodes && search->loop_counter >= max_nodes){
+                break;
             }
-            printf("\n");
-            uint continuous_matches = 0;
-            for (uint i=0; i<=piece_history_index; ++i){
-                geom our_orientation = orientations_history[i][piece_placing_history[i]][orientation_history[i]];
-                if (our_orientation == solution[piece_placing_history[i]]){
-                    printf("+ ", i);
-                    ++continuous_matches;
-                } else {
-                    printf("  ");
-                    continuous_matches = 0;
+            if (stats_file && dump_stats){
+                dump_stats = 0;
+                fprintf(stats_file, "{\"snapshot\": true, \"solutions\": %u, \"nodes\": %lu, \"progress\": %g, ",
+                    solution_count, search->loop_counter, search_progress(search));
+                print_search_stats_json(stats_file, &search->stats);
+                fprintf(stats_file, "}\n");
+                fflush(stats_file);
+            }
+            if (checkpoint_path && (save_checkpoint || seconds_now() - previous_checkpoint >= CHECKPOINT_EVERY)){
+                save_checkpoint = 0;
+                if (checkpoint_save(checkpoint_path, search, solution_count, *symmetric_solution_count) && print_solutions){
+                    printf("Saved a checkpoint to %s.\n", checkpoint_path);
                 }
+                previous_checkpoint = seconds_now();
             }
-            printf("\n");
-            #endif
+            continue;
+        }
+        uint copy_count = 1;
+        if (symmetry){
+            copy_count = symmetric_solutions(symmetry, search->placed_history, search->piece_placing_history, NULL);
+            if (copy_count == 0){
+                continue; // We'll find (or have found) a symmetric copy of this one instead
+            }
+        }
+        if (++solution_count == 1){
+            *first_solution_at = seconds_now();
+        }
+        *symmetric_solution_count += copy_count;
+        #ifdef STOP_AT_FIRST_SOLUTION
+            if (print_solutions){
+                printf("\nStopping at first solution!\n");
+            }
+            break; // We've placed all the pieces: we're done!
+        #else
+            if (print_solutions && solution_count <= solutions_to_print){
+                printf("Solution %u:\n", solution_count);
+                print_colored_pieces_in_space(search->placed_history, search->piece_placing_history, search->piece_history_index, search->piece_colors, num_pieces);
+                if (symmetry && symmetry->expand){
+                    print_symmetric_copies(symmetry, search->placed_history, search->piece_placing_history, search->piece_colors);
+                }
+            }
+        #endif
+    }
+    *finished = result == SEARCH_DONE && keep_running;
 
-            ++piece_history_index; // Moving on to the next piece
-            orientation_placing = 0; // Starting with the first orientation for the next piece.
+    if (checkpoint_path){
+        if (*finished){
+            remove(checkpoint_path); // Nothing left to resume
+        } else if (checkpoint_save(checkpoint_path, search, solution_count, *symmetric_solution_count)){
+            printf("\nSaved a checkpoint to %s: run again with --checkpoint=%s to carry on.\n", checkpoint_path, checkpoint_path);
+        }
+    }
 
-            // Now, checking if there's any reason to quit or undo this placement.
-            // Set backout to true if we need to undo this placement and try the next orientation.
+    if (print_solutions){
+        if (!keep_running){
+            printf("\nInterupt detected. Exiting.\n");
+            printf("\nPlaced %u pieces.\n", search->piece_history_index+1);
+        } else if (result == SEARCH_DONE){
+            printf("\nTried all the permutations.\n");
+        }
+        printf("\nStopped while placing piece %u orientation %u.\n", search->piece_history_index+1, search->orientation_placing+1);
+        if (!*finished){
+            printf("About %.2g%% of the tree was searched.\n", search_progress(search) * 100.0);
+        }
+    }
+    return solution_count;
+}
 
-            // If we've placed the last piece, we either stop or backout to find more solutions:
-            if (piece_history_index == NUM_PIECES){ // Have we placed all the pieces?
-                #ifdef STOP_AT_FIRST_SOLUTION
-                    printf("\nStopping at first solution!\n");
-                    break; // We've placed all the pieces: we're done!
-                #else
-                    ++solution_count; // Counting this as a solution and continuing.
-                    printf("Solution %u:\n", solution_count);
-                    print_colored_pieces_in_space(orientations_history, orientation_history, piece_placing_history, piece_history_index);
-                    backout = true;
-                #endif
+void print_last_placements(struct search *search){
+    char **piece_colors = search->piece_colors;
+    printf("Space:\n\n");
+    print_space(search->space);
+
+    print_colored_pieces_in_space(search->placed_history, search->piece_placing_history, search->piece_history_index, piece_colors, num_pieces);
+
+    printf("Orientations:\n\n");
+    for (uint i=0; i<search->piece_history_index; ++i){
+        printf("Piece %u:\n", search->piece_placing_history[i]+1);
+        print_piece(search->placed_history[i], piece_colors[search->piece_placing_history[i]]);
+        printf("\n");
+    }
+}
+
+int solve_puzzle(struct puzzle *puzzle, struct options *options, struct workspace *w, char *puzzle_name,
+        struct solve_stats *stats){
+    /*
+    Sets up puzzle's orientations and searches for its solutions as the options say,
+    printing them (or with options->batch, a line of CSV about them; with
+    options->benchmark_runs, nothing) and filling in stats.
+    */
+    bool verbose = !options->batch && !options->benchmark_runs;
+    use_puzzle(puzzle);
+    track_coverage = options->coverage && space_will_be_full;
+    force_spots = options->forced;
+    backjump = options->backjump;
+    check_hole_sums &= options->hole_sums;
+    transpositions_reset(options->engine == ENGINE_MRV ? options->transposition_megabytes : 0);
+    if (options->branch_on_cells && !space_will_be_full){
+        printf("%s: --branch=cell needs the pieces to fill the whole box.\n", puzzle_name);
+        return 1;
+    }
+    uint cut = options->cut ? options->cut : space_size / 2;
+    if (options->engine == ENGINE_MITM && (!space_will_be_full || cut >= space_size)){
+        printf("%s: --engine=mitm needs the pieces to fill the whole box, and the cut to be inside it.\n", puzzle_name);
+        return 1;
+    }
+    if (options->engine == ENGINE_FRONTIER && !space_will_be_full){
+        printf("%s: --engine=frontier needs the pieces to fill the whole box.\n", puzzle_name);
+        return 1;
+    }
+
+    if (verbose){
+        printf("\nStarting...\n");
+        printf("%u pieces in a %u x %u x %u box.\n", num_pieces, space_width, space_height, space_depth);
+        printf("full_space:\n");
+        print_space(full_space_mask);
+    }
+
+    double start = seconds_now();
+    clock_t start_clock = clock();
+    double total_permutations = 1;
+
+    if (!w->orientation_scratch){
+        w->orientation_scratch = malloc(PIECE_ORIENTATIONS_LIMIT * sizeof(geom));
+    }
+    uint offsets[MAX_PIECES];
+    uint total_orientation_count = 0;
+    for (uint i=0; i<num_pieces; i++){
+        uint group = puzzle->groups[i];
+        uint count = group == i ? populate_orientations(w->orientation_scratch, puzzle->pieces[i], options->mirrors) : w->orientation_counts[group];
+        if (total_orientation_count + count > w->orientation_store_size){
+            w->orientation_store_size = 2 * (total_orientation_count + count);
+            w->orientation_store = realloc(w->orientation_store, w->orientation_store_size * sizeof(geom));
+        }
+        geom *from = group == i ? w->orientation_scratch : w->orientation_store + offsets[group];
+        memcpy(w->orientation_store + total_orientation_count, from, count * sizeof(geom));
+        offsets[i] = total_orientation_count;
+        w->orientation_counts[i] = count;
+        total_orientation_count += count;
+        if (verbose){
+            if (puzzle->names[i][0]){
+                printf("Found %u unique orientations for piece %u (%s).\n", count, i+1, puzzle->names[i]);
+            } else {
+                printf("Found %u unique orientations for piece %u.\n", count, i+1);
             }
+        }
+        total_permutations *= count;
+    }
+    for (uint i=0; i<num_pieces; i++){
+        w->orientations[i] = w->orientation_store + offsets[i];
+    }
+    double orientations_done = seconds_now();
+    geom **orientations = w->orientations;
+    uint *orientation_counts = w->orientation_counts;
+    char **piece_colors = puzzle->colors;
 
-            #ifdef TRACK_PROGRESS
-            double new_permutations = 1;
-            #endif
+    if (verbose){
+        printf("Total permutations: %e\n", total_permutations);
+    }
 
-            #ifdef SPACE_WILL_BE_FULL
-            geom potential_space_fill = space;
-            #endif
+    struct symmetry *symmetry = NULL;
+    if (options->break_symmetry){
+        symmetry = &w->symmetry;
+        symmetry->expand = options->expand_symmetry;
+        symmetry_init(symmetry, orientations, orientation_counts);
+        if (verbose){
+            printf("Breaking symmetry: %u symmetries of the box keep the pieces the same. Restricted piece %u from %u to %u orientations.\n",
+                symmetry->count, symmetry->piece+1, symmetry->unrestricted_count, orientation_counts[symmetry->piece]);
+        }
+    }
 
-            // Trimming down what remaining pieces and orientations we have:
-            // Also, if a piece doesn't fit anymore, we backout.
-            uint *orientations_counts_at_previous_piece = orientation_counts_history[piece_history_index-1];
-            uint *orientations_counts_at_this_piece = orientation_counts_history[piece_history_index];
-            uint smallest_orientations_count = 10000;
-            uint piece_placing_index_for_smallest_orientations_count;
-            for (uint i=0; i<NUM_PIECES; ++i){ // Loop over all pieces
-                if (i == piece_placing_index || orientations_counts_at_previous_piece[i] == 0){ // Zero here is a sentinel for already placed
-                    // printf("Skipping orientations for piece %u\n", i+1);
-                    orientations_counts_at_this_piece[i] = 0; // Setting the sentinel of 0 to mena already placed.
-                    continue; // Only worrying about the  remaining pieces
-                }
-                geom *piece_orientations = orientations_history[piece_history_index-1][i];
-                uint new_orientation_count = 0;
-                uint orientation_count = orientations_counts_at_previous_piece[i];
-                for (uint remaining_orientation=0; remaining_orientation<orientation_count; ++remaining_orientation){ // Loop over it's orientations
-                    geom piece_orientation = piece_orientations[remaining_orientation];
-                    if (!(space & piece_orientation)){
-                        // If this piece still fits in the space in this orientation:
-                        orientations_history[piece_history_index][i][new_orientation_count] = piece_orientation;
-                        ++new_orientation_count;
-                        #ifdef SPACE_WILL_BE_FULL
-                        potential_space_fill |= piece_orientation;
-                        #endif
-                    }
-                }
-                orientations_counts_at_this_piece[i] = new_orientation_count;
+    double symmetry_done = seconds_now();
 
-                #ifdef TRACK_PROGRESS
-                new_permutations *= new_orientation_count;
-                #endif
+    // After symmetry_init() so the index only has the orientations we're keeping:
+    struct cell_index *cell_index = NULL;
+    if ((options->branch_on_cells && options->engine == ENGINE_MRV) || options->engine >= ENGINE_MITM){
+        cell_index = &w->cell_index;
+        cell_index_init(cell_index, orientations, orientation_counts);
+        if (verbose){
+            printf("Branching on the lowest empty spot (%u placements indexed).\n", cell_index->offsets[space_size]);
+        }
+    }
 
-                // printf("Trimmed piece %u from %u to %u.\n", remaining_piece+1, orientation_count, new_orientation_count);
-                // printf("Down to %u orientations for piece %u.\n", new_orientation_count, remaining_piece+1);
-
-                if (new_orientation_count == 0){ // Some piece does not fit anymore
-                    // printf("  backout\n");
-                    #ifdef VERBOSE
-                    printf("Backing out: no orientations left for piece %u.\n", i+1);
-                    #endif
-                    backout = true;
-                    #ifdef TRACK_PROGRESS
-                    ++backout_no_orientations_left_for_a_piece;
-                    #endif
-                    break;
-                    // printf("Piece %u does not fit anymore.\n", remaining_piece+1);
-                }
+    double index_done = seconds_now();
 
-                // Tracking which piece has the fewest orientations left so we can try it next for speed:
-                if (new_orientation_count < smallest_orientations_count){
-                    smallest_orientations_count = new_orientation_count;
-                    piece_placing_index_for_smallest_orientations_count = i;
-                }
+    if (options->benchmark_filter){
+        print_filter_benchmark(orientations, orientation_counts);
+        return 0;
+    }
 
-            }
+    if (options->speedup){
+        print_speedup_curve(orientations, orientation_counts, piece_colors, symmetry, cell_index);
+        return 0;
+    }
 
-            // Checking if it's still possible to fill in every spot in the space:
-            #ifdef SPACE_WILL_BE_FULL
-            if (!backout && potential_space_fill != full_space){
-                #ifdef VERBOSE
-                printf("Backing out: some part of space cannot be filled.\n");
-                // print_space(potential_space_fill);
-                #endif
-                backout = true;
-                #ifdef TRACK_PROGRESS
-                ++backout_some_part_of_space_cannot_be_filled;
-                #endif
+    uint solution_count;
+    long unsigned int symmetric_solution_count = 0;
+    long unsigned int loop_counter = 0;
+    double first_solution_at = 0;
+    bool finished = true;
+    uint solutions_to_print = options->count_only ? options->solutions_to_print : UINT_MAX;
+    if (options->engine == ENGINE_DLX){
+        solution_count = solve_with_dlx(orientations, orientation_counts, piece_colors, verbose, solutions_to_print,
+            symmetry, &loop_counter, &symmetric_solution_count, &stats->search, &first_solution_at);
+    } else if (options->engine == ENGINE_MITM){
+        solution_count = solve_meet_in_the_middle(orientations, orientation_counts, piece_colors, cell_index, cut,
+            verbose, &loop_counter, &stats->search, &first_solution_at, &finished);
+    } else if (options->engine == ENGINE_FRONTIER){
+        solution_count = count_by_frontier(cell_index, verbose, &loop_counter, &stats->search, &finished);
+    } else if (options->thread_count > 0 || options->shard.count > 0){
+        struct shard shard_options = options->shard; // Each puzzle picks its own depth
+        struct shard *shard = options->shard.count > 0 ? &shard_options : NULL;
+        uint thread_count = options->thread_count > 0 ? options->thread_count : 1;
+        solution_count = solve_in_parallel(thread_count, orientations, orientation_counts, piece_colors, verbose,
+            solutions_to_print, symmetry, cell_index, shard, &loop_counter, &symmetric_solution_count, &stats->search,
+            &first_solution_at);
+        if (verbose){
+            if (shard){
+                printf("Shard %u/%u: searched %u of the %u subtrees %u pieces down (about %.0f%% of the tree).\n",
+                    shard->index+1, shard->count, shard->task_count, shard->subtree_count, shard->depth, shard->share * 100.0);
+            }
+            printf("Searched using %u threads.\n", thread_count);
+        }
+    } else {
+        if (!w->search){
+            w->search = calloc(1, sizeof(struct search));
+        }
+        struct search *search = w->search;
+        search_start(search, orientations, orientation_counts, piece_colors, cell_index);
+        search->show_progress = verbose;
+        solution_count = 0;
+        if (options->checkpoint_path){
+            uint status = checkpoint_load(options->checkpoint_path, search, &solution_count, &symmetric_solution_count);
+            if (status == CHECKPOINT_INVALID){
+                return 1;
             }
+            if (status == CHECKPOINT_RESUMED && verbose){
+                printf("Resuming from %s: %u solutions found and %lu nodes visited so far.\n",
+                    options->checkpoint_path, solution_count, search->loop_counter);
+            }
+        }
+        if (verbose){
+            printf("Setup in %.1f seconds.\n", ((double) (clock() - start_clock)) / CLOCKS_PER_SEC);
+        }
+        solution_count = solve_serially(search, symmetry, verbose, solutions_to_print, options->checkpoint_path,
+            options->max_nodes, options->stats_file, solution_count, &symmetric_solution_count, &first_solution_at, &finished);
+        loop_counter = search->loop_counter;
+        if (verbose && !finished && keep_running){
+            printf("\nStopped after visiting %lu nodes (--max-nodes=%lu).\n", loop_counter, options->max_nodes);
+        }
+        stats->search = search->stats;
+        if (verbose){
+            #ifndef STOP_AT_FIRST_SOLUTION
+            print_solution_count(solution_count, symmetry, symmetric_solution_count);
             #endif
-
-            // Checking if it's still possible to fit the pieces into the divisions in the space:
-            #ifdef COMMON_PIECE_SIZE
-            if (!backout && !are_empty_spaces_factors(space)){
-                // If all our pieces are of size 3 unit cubes (for example) and we've split the space into two (or more)
-                // separate holes, the space isn't solvable unless each of those holes has a number of unit cubes
-                // that's a multiple of 3.
-                #ifdef VERBOSE
-                printf("Backing out: empty spaces are not factors.");
-                #endif
-                backout = true;
-                #ifdef TRACK_PROGRESS
-                ++backout_are_empty_spaces_factors;
+            if (!options->count_only){
+                #ifndef STOP_AT_FIRST_SOLUTION
+                printf("\nLast solution:\n");
                 #endif
+                print_last_placements(search);
+            }
+        }
+    }
 
-                // print_space(space);
-                // return 0;
+    double duration = seconds_now() - start;
+    stats->solution_count = solution_count;
+    stats->symmetric_solution_count = symmetry ? symmetric_solution_count : solution_count;
+    stats->nodes = loop_counter;
+    stats->seconds = duration;
+    stats->first_solution_seconds = first_solution_at >= start ? first_solution_at - start : -1.0; // Not if resumed after it
+    stats->finished = finished && keep_running;
+    stats->orientation_seconds = orientations_done - start;
+    stats->symmetry_seconds = symmetry_done - orientations_done;
+    stats->index_seconds = index_done - symmetry_done;
+    stats->search_seconds = start + duration - index_done;
+    if (options->stats_file){
+        print_solve_stats_json(options->stats_file, puzzle_name, options, stats);
+    }
+    if (options->benchmark_runs){
+        return 0;
+    }
+    if (options->batch){
+        printf("%s,%u,%u,%u,%lu,%lu,%.3f\n", puzzle_name, space_size, num_pieces, solution_count,
+            symmetry ? symmetric_solution_count : solution_count, loop_counter, duration);
+        fflush(stdout);
+    } else {
+        if (options->engine != ENGINE_MRV || options->thread_count > 0 || options->shard.count > 0){
+            if (!keep_running){
+                printf("\nInterupt detected. Exiting.\n");
             }
-            #endif
+            if (!finished || !keep_running){
+                printf("Stopped before the end, so this count is only partial.\n");
+            }
+            print_solution_count(solution_count, symmetry, symmetric_solution_count);
+        }
+        if (options->count_only){
+            print_placements_at_depth(stats->search.placements_at_depth);
+        }
+        printf("Visited %lu nodes in %.1f seconds (%.2f million nodes/second).\n",
+            loop_counter, duration, (double)loop_counter/duration/1000000.0);
+        if (options->engine == ENGINE_MRV && !options->branch_on_cells){
+            printf("Forced %lu placements: %lu pieces had one orientation left and %lu spots only one orientation could fill.\n",
+                stats->search.forced_pieces + stats->search.forced_spots, stats->search.forced_pieces, stats->search.forced_spots);
+        }
+        if (transpositions.entries){
+            struct search_stats *search_stats = &stats->search;
+            printf("Transposition table (%zu MB): %lu of %lu lookups were dead ends (%.1f%%), %lu stored (%lu pushing out another).\n",
+                transpositions.size >> 20, search_stats->prunes[PRUNE_TRANSPOSITION], search_stats->transposition_lookups,
+                search_stats->transposition_lookups ? 100.0 * (double)search_stats->prunes[PRUNE_TRANSPOSITION] / (double)search_stats->transposition_lookups : 0.0,
+                search_stats->transposition_stores, search_stats->transposition_replacements);
+        }
+        printf("Done in %.1f seconds.\n", duration);
+    }
+    return 0;
+}
 
-            // Figure out the best order to try and place the remaining pieces in:
-            #ifdef VERBOSE
-            if (!backout){
-                printf("Decided to place piece %u next (%u orientations).\n",
-                    piece_placing_index_for_smallest_orientations_count+1,
-                    orientation_counts_history[piece_history_index][piece_placing_index_for_smallest_orientations_count]);
+uint test_engines(){
+    /*
+    Solves a couple of tiny puzzles with each engine and checks they all count the same
+    solutions. Separate from test() as it needs solve_puzzle().
+    */
+    uint failures = 0;
+    char *puzzle_texts[] = {
+        "box 3 2 1\npiece 0,0,0 1,0,0 x2\npiece 0,0,0 0,1,0\n",
+        "box 5 3 2\npiece 0,0,0 1,0,0 2,0,0 3,0,0 4,0,0\npiece 0,0,0 1,0,0 2,0,0 0,1,0 1,1,0 x5\n", // problem1.txt
+    };
+    static struct puzzle puzzle;
+    static struct workspace workspace;
+    for (uint i=0; i<sizeof(puzzle_texts)/sizeof(puzzle_texts[0]); ++i){
+        FILE *puzzle_file = fmemopen(puzzle_texts[i], strlen(puzzle_texts[i]), "r");
+        assertTrue(read_puzzle(puzzle_file, "test", &puzzle), "The engine test puzzle should be read.");
+        fclose(puzzle_file);
+        uint counts[ENGINE_FRONTIER + 2];
+        for (uint engine=ENGINE_MRV; engine<=ENGINE_FRONTIER + 1; ++engine){
+            struct options options = {0};
+            options.engine = engine <= ENGINE_FRONTIER ? engine : ENGINE_MRV;
+            options.branch_on_cells = engine > ENGINE_FRONTIER; // The default engine both ways
+            options.forced = true;
+            options.count_only = true;
+            options.benchmark_runs = 1; // So solve_puzzle() doesn't print anything
+            struct solve_stats stats;
+            assertTrue(solve_puzzle(&puzzle, &options, &workspace, "test", &stats) == 0 && stats.finished,
+                "Each engine should solve the engine test puzzles.");
+            counts[engine] = stats.solution_count;
+            if (counts[engine] != counts[ENGINE_MRV] || counts[engine] == 0){
+                printf("\nfailed: %s%s found %u solutions to engine test puzzle %u, rather than %u", engine_names[options.engine],
+                    options.branch_on_cells ? " (branching on cells)" : "", counts[engine], i+1, counts[ENGINE_MRV]);
+                ++failures;
             }
-            #endif
-            piece_placing_index = piece_placing_index_for_smallest_orientations_count;
-            // piece_placing_index = piece_history_index;
-            piece_placing_history[piece_history_index] = piece_placing_index;
-
-            #ifdef TRACK_PROGRESS
-            // printf("Scanning pieces ruled out %e permutations.\n", permutations_history[piece_history_index-1] - new_permutations);
-            permutations_tried += (
-                permutations_history[piece_history_index-1] / (double)orientations_counts_at_previous_piece[piece_placing_history[piece_history_index-1]]
-                ) - new_permutations;
-
-            // printf("%e / %e = %e... - %e = %e\n",
-            //     permutations_history[piece_history_index-1],
-            //     (double)orientations_counts_at_previous_piece[piece_placing_history[piece_history_index-1]],
-            //     permutations_history[piece_history_index-1] / (double)orientations_counts_at_previous_piece[piece_placing_history[piece_history_index-1]],
-            //     new_permutations,
-            //     (permutations_history[piece_history_index-1] / (double)orientations_counts_at_previous_piece[piece_placing_history[piece_history_index-1]]) - new_permutations
-            //     );
-            // printf("permutations_tried: %e\n", permutations_tried);
-            // usleep(200000);
-            permutations_history[piece_history_index] = new_permutations;
+        }
+    }
+    workspace_free(&workspace);
+    memset(&workspace, 0, sizeof(workspace));
+    return failures;
+}
 
-            #endif
+/*
+Benchmarks: a fixed set of puzzles to time the search on, so changes to it can be compared
+run against run. The default engine on one thread only visits the same nodes every time,
+so the node counts should match exactly and only the times should move.
+
+Each run is in a process of its own (fork()ed), so one run's peak memory use (the
+resident set size) and allocations don't carry over into the next one's. The puzzles
+that take too long to search completely stop at a fixed number of nodes.
+*/
+
+#define BENCHMARK_DEFAULT_RUNS 5
 
-            // if (backout){
-            //     print_colored_pieces_in_space(orientations_history, orientation_history, piece_placing_history, piece_history_index);
-            //     #ifdef SPACE_WILL_BE_FULL
-            //     print_space(potential_space_fill);
-            //     #endif
-            //     printf("\n");
-            // }
+struct benchmark_puzzle {
+    char *path; // Relative to c/. NULL for the built in 5x5x5 puzzle
+    long unsigned int max_nodes; // 0 to search the whole tree
+};
+
+const struct benchmark_puzzle benchmark_puzzles[] = {
+    {"puzzles/soma.txt", 0},
+    {"puzzles/pentominoes_2x3x10.txt", 0},
+    {"puzzles/pentominoes_2x5x6.txt", 0},
+    {"puzzles/pentominoes_3x4x5.txt", 20000000},
+    {NULL, 20000000},
+    {"puzzles/pentominoes_2x3x10_no_i.txt", 0}, // No solutions: all tree, no leaves
+    {"puzzles/pentominoes_2x3x10_no_p.txt", 0},
+};
+
+struct benchmark_run {
+    struct solve_stats stats;
+    long peak_rss_kb;
+    int status; // solve_puzzle()'s, or 1 if the puzzle didn't load
+};
+
+int compare_doubles(const void *a, const void *b){
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void median_and_stddev(double *values, uint count, double *median, double *stddev){
+    // Sorts values.
+    qsort(values, count, sizeof(double), compare_doubles);
+    *median = count % 2 ? values[count/2] : (values[count/2 - 1] + values[count/2]) / 2;
+    double mean = 0;
+    for (uint i=0; i<count; ++i){
+        mean += values[i];
+    }
+    mean /= count;
+    double variance = 0;
+    for (uint i=0; i<count; ++i){
+        variance += (values[i] - mean) * (values[i] - mean);
+    }
+    *stddev = count > 1 ? sqrt(variance / (count - 1)) : 0;
+}
+
+bool benchmark_once(char *path, struct options *options, struct benchmark_run *run){
+    /*
+    Solves the puzzle at path (or the built in one for NULL) in a child process, filling in
+    run. Returns false if the child didn't get as far as reporting back.
+    */
+    int fds[2];
+    if (pipe(fds) != 0){
+        perror("pipe");
+        return false;
+    }
+    fflush(stdout); // Or the child prints it again
+    pid_t child = fork();
+    if (child < 0){
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (child == 0){
+        close(fds[0]);
+        static struct puzzle puzzle;
+        struct workspace workspace = {0};
+        struct benchmark_run result = {0};
+        result.status = 1;
+        if (!path){
+            builtin_puzzle(&puzzle);
+            result.status = solve_puzzle(&puzzle, options, &workspace, "builtin", &result.stats);
+        } else if (load_puzzle(path, &puzzle)){
+            result.status = solve_puzzle(&puzzle, options, &workspace, path, &result.stats);
         }
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        result.peak_rss_kb = usage.ru_maxrss;
+        fflush(stdout); // _exit() doesn't
+        if (write(fds[1], &result, sizeof(result)) != (ssize_t)sizeof(result)){
+            _exit(1);
+        }
+        _exit(0);
     }
+    close(fds[1]);
+    bool reported = read(fds[0], run, sizeof(*run)) == (ssize_t)sizeof(*run);
+    close(fds[0]);
+    waitpid(child, NULL, 0);
+    return reported;
+}
 
-    printf("\nStopped while placing piece %u orientation %u.\n", piece_history_index+1, orientation_placing+1);
+int run_benchmark(struct options *options, char **puzzle_files, uint puzzle_file_count){
+    /*
+    Solves each puzzle options->benchmark_runs times, printing a line of CSV per puzzle: the
+    median and standard deviation of the seconds taken to find the first solution and all
+    of them, how many nodes a second that is and the most memory any of the runs used.
+    Without puzzle_files, uses benchmark_puzzles (with options->max_nodes for puzzle_files).
+    */
+    uint runs = options->benchmark_runs;
+    uint puzzle_count = puzzle_file_count > 0 ? puzzle_file_count : sizeof(benchmark_puzzles) / sizeof(benchmark_puzzles[0]);
+    double *seconds = malloc(runs * sizeof(double));
+    double *first_solution_seconds = malloc(runs * sizeof(double));
+    int status = 0;
+
+    printf("puzzle,runs,solutions,nodes,finished,first_solution_median,first_solution_stddev,"
+        "seconds_median,seconds_stddev,million_nodes_per_second,peak_rss_kb\n");
+    for (uint i=0; i<puzzle_count && keep_running; ++i){
+        struct options puzzle_options = *options;
+        char *path = puzzle_files[i];
+        if (puzzle_file_count == 0){
+            path = benchmark_puzzles[i].path;
+            puzzle_options.max_nodes = benchmark_puzzles[i].max_nodes;
+        }
+        char *name = path ? path : "builtin";
+        if (!path && MAX_SPACE_SIZE < 125){
+            continue; // Doesn't fit
+        }
 
-    #ifdef TRACK_PROGRESS
-    printf("Tried %e permutations of %e (%.4f %%).\n", permutations_tried, total_permutations, permutations_tried / total_permutations * 100.0);
-    #endif
+        struct benchmark_run run;
+        struct solve_stats first_run = {0};
+        long peak_rss_kb = 0;
+        uint run_count = 0;
+        bool consistent = true;
+        for (; run_count<runs && keep_running; ++run_count){
+            if (!benchmark_once(path, &puzzle_options, &run) || run.status != 0){
+                break;
+            }
+            if (run_count == 0){
+                first_run = run.stats;
+            } else if (run.stats.nodes != first_run.nodes || run.stats.solution_count != first_run.solution_count){
+                consistent = false;
+            }
+            if (!run.stats.finished && !puzzle_options.max_nodes){
+                break; // Interupted
+            }
+            seconds[run_count] = run.stats.seconds;
+            first_solution_seconds[run_count] = run.stats.first_solution_seconds;
+            if (run.peak_rss_kb > peak_rss_kb){
+                peak_rss_kb = run.peak_rss_kb;
+            }
+        }
+        if (run_count < runs){
+            if (keep_running){
+                printf("%s: couldn't be solved.\n", name);
+                status = 1;
+            }
+            continue;
+        }
+        if (!consistent){
+            printf("%s: the runs visited different numbers of nodes.\n", name);
+            status = 1;
+        }
 
-    #ifndef STOP_AT_FIRST_SOLUTION
-    printf("Found %u solutions.\n", solution_count);
-    printf("\nLast solution:\n");
-    #endif
+        double seconds_median, seconds_stddev;
+        median_and_stddev(seconds, runs, &seconds_median, &seconds_stddev);
+        printf("%s,%u,%u,%lu,%s,", name, runs, first_run.solution_count, first_run.nodes, first_run.finished ? "yes" : "no");
+        if (first_run.solution_count > 0){
+            double first_median, first_stddev;
+            median_and_stddev(first_solution_seconds, runs, &first_median, &first_stddev);
+            printf("%.4f,%.4f,", first_median, first_stddev);
+        } else {
+            printf(",,");
+        }
+        printf("%.4f,%.4f,%.2f,%ld\n", seconds_median, seconds_stddev,
+            (double)first_run.nodes / seconds_median / 1000000.0, peak_rss_kb);
+        fflush(stdout);
+    }
 
-    printf("Space:\n\n");
-    print_space(space);
+    free(seconds);
+    free(first_solution_seconds);
+    return status;
+}
+
+int main(int argc, char **argv){
+    struct options options = {0};
+    options.engine = ENGINE_MRV;
+    options.forced = true;
+    char **puzzle_files = calloc((size_t)argc, sizeof(char *));
+    uint puzzle_file_count = 0;
+    for (int i=1; i<argc; ++i){
+        if (strcmp(argv[i], "--engine=mrv") == 0){
+            options.engine = ENGINE_MRV;
+        } else if (strcmp(argv[i], "--engine=dlx") == 0){
+            options.engine = ENGINE_DLX;
+        } else if (strcmp(argv[i], "--engine=mitm") == 0){
+            options.engine = ENGINE_MITM;
+        } else if (strcmp(argv[i], "--engine=frontier") == 0){
+            options.engine = ENGINE_FRONTIER;
+        } else if (strncmp(argv[i], "--cut=", 6) == 0){
+            options.cut = (uint)strtoul(argv[i] + 6, NULL, 10);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0){
+            options.thread_count = (uint)strtoul(argv[i] + 10, NULL, 10);
+            if (options.thread_count == 0){
+                options.thread_count = (uint)sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        } else if (strcmp(argv[i], "--speedup") == 0){
+            options.speedup = true;
+        } else if (strcmp(argv[i], "--benchmark-filter") == 0){
+            options.benchmark_filter = true;
+        } else if (strcmp(argv[i], "--symmetry") == 0){
+            options.break_symmetry = true;
+        } else if (strcmp(argv[i], "--symmetry=expand") == 0){
+            options.break_symmetry = true;
+            options.expand_symmetry = true;
+        } else if (strcmp(argv[i], "--branch=piece") == 0){
+            options.branch_on_cells = false;
+        } else if (strcmp(argv[i], "--branch=cell") == 0){
+            options.branch_on_cells = true;
+        } else if (strcmp(argv[i], "--batch") == 0){
+            options.batch = true;
+        } else if (strcmp(argv[i], "--mirrors") == 0){
+            options.mirrors = true;
+        } else if (strcmp(argv[i], "--coverage") == 0){
+            options.coverage = true;
+        } else if (strcmp(argv[i], "--no-forced") == 0){
+            options.forced = false;
+        } else if (strcmp(argv[i], "--backjump") == 0){
+            options.backjump = true;
+        } else if (strcmp(argv[i], "--hole-sums") == 0){
+            options.hole_sums = true;
+        } else if (strcmp(argv[i], "--transpositions") == 0){
+            options.transposition_megabytes = TRANSPOSITION_DEFAULT_MEGABYTES;
+        } else if (strncmp(argv[i], "--transpositions=", 17) == 0){
+            options.transposition_megabytes = (uint)strtoul(argv[i] + 17, NULL, 10);
+        } else if (strncmp(argv[i], "--checkpoint=", 13) == 0){
+            options.checkpoint_path = argv[i] + 13;
+        } else if (strncmp(argv[i], "--shard=", 8) == 0){
+            uint index = 0;
+            uint count = 0;
+            if (sscanf(argv[i] + 8, "%u/%u", &index, &count) != 2 || index < 1 || index > count){
+                printf("--shard needs to be I/N, with I from 1 to N.\n");
+                return 1;
+            }
+            options.shard.index = index - 1;
+            options.shard.count = count;
+        } else if (strncmp(argv[i], "--shard-depth=", 14) == 0){
+            options.shard.depth = (uint)strtoul(argv[i] + 14, NULL, 10);
+        } else if (strcmp(argv[i], "--count") == 0){
+            options.count_only = true;
+        } else if (strncmp(argv[i], "--count=", 8) == 0){
+            options.count_only = true;
+            options.solutions_to_print = (uint)strtoul(argv[i] + 8, NULL, 10);
+        } else if (strcmp(argv[i], "--stats") == 0){
+            options.stats_file = stderr;
+        } else if (strncmp(argv[i], "--stats=", 8) == 0){
+            options.stats_file = fopen(argv[i] + 8, "w");
+            if (!options.stats_file){
+                printf("Can't write stats to %s.\n", argv[i] + 8);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--max-nodes=", 12) == 0){
+            options.max_nodes = strtoul(argv[i] + 12, NULL, 10);
+        } else if (strcmp(argv[i], "--benchmark") == 0){
+            options.benchmark_runs = BENCHMARK_DEFAULT_RUNS;
+        } else if (strncmp(argv[i], "--benchmark=", 12) == 0){
+            options.benchmark_runs = (uint)strtoul(argv[i] + 12, NULL, 10);
+            if (options.benchmark_runs == 0){
+                printf("--benchmark needs at least 1 run.\n");
+                return 1;
+            }
+        } else if (argv[i][0] != '-'){
+            puzzle_files[puzzle_file_count++] = argv[i];
+        } else {
+            printf("Usage: %s [--engine=mrv|dlx|mitm|frontier] [--cut=SPOTS] [--threads=N (0 for one per core)] [--speedup] [--benchmark-filter] [--symmetry[=expand]] [--branch=piece|cell] [--coverage] [--no-forced] [--backjump] [--hole-sums] [--transpositions[=MB]] [--mirrors] [--count[=N]] [--checkpoint=FILE] [--shard=I/N [--shard-depth=D]] [--max-nodes=N] [--benchmark[=RUNS]] [--stats[=FILE]] [--batch] [PUZZLE_FILE...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (options.batch && (options.speedup || options.benchmark_filter)){
+        printf("--batch doesn't go with --speedup or --benchmark-filter.\n");
+        return 1;
+    }
+    if (options.shard.count > 0 && (options.engine != ENGINE_MRV || options.speedup)){
+        printf("--shard only works with the default engine, and not with --speedup.\n");
+        return 1;
+    }
+    if (options.checkpoint_path && (options.engine != ENGINE_MRV || options.thread_count > 0 || options.shard.count > 0
+            || options.batch || puzzle_file_count > 1)){
+        printf("--checkpoint only works searching one puzzle on one thread with the default engine.\n");
+        return 1;
+    }
+    if ((options.max_nodes || options.benchmark_runs) && (options.engine != ENGINE_MRV || options.thread_count > 0
+            || options.shard.count > 0 || options.checkpoint_path || options.speedup || options.benchmark_filter)){
+        printf("--max-nodes and --benchmark only work on one thread with the default engine, without a checkpoint.\n");
+        return 1;
+    }
+    if (options.engine >= ENGINE_MITM && (options.thread_count > 0 || options.break_symmetry)){
+        printf("--engine=mitm and --engine=frontier only count solutions on one thread: they don't go with --threads or --symmetry.\n");
+        return 1;
+    }
+    if (options.benchmark_runs && (options.batch || options.stats_file)){
+        printf("--benchmark prints CSV already: it doesn't go with --batch or --stats.\n");
+        return 1;
+    }
 
-    print_colored_pieces_in_space(orientations_history, orientation_history, piece_placing_history, piece_history_index);
+    struct sigaction action;
+    action.sa_handler = sig_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGUSR1, &action, NULL);
 
-    printf("Orientations:\n\n");
-    for (uint i=0; i<piece_history_index; ++i){
-        printf("Piece %u:\n", piece_placing_history[i]+1);
-        uint piece_index = piece_placing_history[i];
-        print_piece(orientations_history[i][piece_index][orientation_history[i]], piece_colors[piece_index]);
-        // print_space_fill(orientations_history[i][i][orientation_history[i]], i+1);
-        printf("\n");
+    init_filter_orientations();
+
+    bool quiet = options.batch || options.benchmark_runs;
+    if (!quiet){
+        printf("\nRunning tests...\n");
+    }
+    uint failures = test() + test_engines();
+    if (failures == 0){
+        if (!quiet){
+            printf("passed!\n");
+        }
+    } else {
+        printf("\nThere were %u test failures. Exiting.\n", failures);
+        return 1;
     }
 
-    duration = ((double) (end - start)) / CLOCKS_PER_SEC;
-    printf("Done in %.1f seconds.\n", duration);
-    // printf("Done!\n");
+    if (options.benchmark_runs){
+        int status = run_benchmark(&options, puzzle_files, puzzle_file_count);
+        free(puzzle_files);
+        return status;
+    }
 
+    static struct puzzle puzzle;
+    static struct workspace workspace;
+    struct solve_stats stats;
+    int status = 0;
+    if (options.batch){
+        printf("puzzle,spots,pieces,solutions,symmetric_solutions,nodes,seconds\n");
+    }
+    if (puzzle_file_count == 0){
+        if (MAX_SPACE_SIZE < 125){
+            printf("The built in puzzle doesn't fit in %u bit geoms: give a puzzle file.\n", MAX_SPACE_SIZE);
+            return 1;
+        }
+        builtin_puzzle(&puzzle);
+        status = solve_puzzle(&puzzle, &options, &workspace, "builtin", &stats);
+    }
+    for (uint i=0; i<puzzle_file_count && keep_running; ++i){
+        if (!load_puzzle(puzzle_files[i], &puzzle)){
+            status = 1;
+            continue;
+        }
+        if (solve_puzzle(&puzzle, &options, &workspace, puzzle_files[i], &stats) != 0){
+            status = 1;
+        }
+    }
 
-    return 0;
+    workspace_free(&workspace);
+    transpositions_reset(0);
+    free(puzzle_files);
+    if (options.stats_file && options.stats_file != stderr){
+        fclose(options.stats_file);
+    }
+    return status;
 }